@@ -1,9 +1,15 @@
 #include "align.h"
+#include "astar-prefix.h"
+#include "astar-seeds.h"
+#include "dijkstra.h"
 
 namespace astarix {
 
-std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max_best_alignments) {
-    LOG_DEBUG << "Aligning read " << r.comment << ": " << r.s << " of length " << r.len << " using " << algo;
+template<typename H>
+std::vector<state_t> Aligner::search(const read_t &r, int max_best_alignments) {
+    LOG_DEBUG << "Aligning read " << r.comment << ": " << r.s << " of length " << r.len;
+    H *astar = static_cast<H*>(this->astar);
+    AllocScope scope(ALLOC_STATE_TABLE);  // p, pe, vis and the prefix cache, unless said otherwise
 
 	assert(max_best_alignments >= 1);
 
@@ -14,7 +20,7 @@ std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max
 
     std::string start_suff;
 
-    {
+    if (!start_from_prefix(r, Q)) {
         pos_t i=0;
 		node_t v=0;
         state_t st(0.0, i, v, -1, -1);          // dummy one-after-last state
@@ -26,14 +32,34 @@ std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max
     for (int steps=0; !Q.empty(); steps++) {
         LOG_DEBUG << r.comment <<  ": step " << steps << " with best curr sort-cost of " << (double)Q.top().first << ", state=" << Q.top().second;
         
+        perf.queue.start();
         auto [curr_score, curr_st] = pop(Q);
+        perf.queue.stop();
+        bool sentinel = curr_st.v == PREFIX_SENTINEL;
 
-        if (G.node_in_trie(curr_st.v)) stats.popped_trie.inc();
+        if (astar->is_dynamic() && !sentinel && curr_st.i < r.len) {
+            // The heuristic may have increased since the push (e.g. by match pruning).
+            stats.t.astar.start();
+            perf.astar.start();
+            cost_t f = curr_st.cost + astar->h(curr_st);
+            perf.astar.stop();
+            stats.t.astar.stop();
+            if (f > curr_score) {
+                stats.reevaluated.inc();
+                perf.queue.start();
+                push(Q, f, curr_st);
+                perf.queue.stop();
+                continue;
+            }
+        }
+
+        if (sentinel) ;
+        else if (G.node_in_trie(curr_st.v)) stats.popped_trie.inc();
         else stats.popped_ref.inc();
 
         // State <curr_st.i, curr_st.v> denotes that the first curr_st.i-1 characters of the read were already aligned before coming to curr_st.v. Next to align is curr_st.i
 
-        if (visited(vis, curr_st.i, curr_st.v)) {
+        if (!sentinel && visited(vis, curr_st.i, curr_st.v)) {
 			// Never gets here if the heuristic is consistent.
             stats.repeated_visits.inc();
             continue;
@@ -49,6 +75,10 @@ std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max
         assert(curr_st.i <= r.len);
         if (!final_states.empty() && !EQ(final_states.front().cost, curr_st.cost))
             break;
+        if (sentinel) {
+            push_prefix_frontier(astar, r, curr_score, Q);
+            continue;
+        }
         if (curr_st.i == r.len) {
             state_t final_state = get_const_path(p, curr_st.i, curr_st.v);
             LOG_DEBUG << "Target reached at state <" << curr_st.v << ", " << curr_st.i << "> with cost " << final_state.cost;
@@ -60,14 +90,19 @@ std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max
                 continue;
         }
 
+        perf.expand.start();
+        astar->on_expand(curr_st);
+
         // lazy DP / Fast-Forward
         if (params.greedy_match)
-            curr_st = proceed_identity(p, pe, curr_st, r);
+            curr_st = proceed_identity(astar, p, pe, curr_st, r);
 
         for (auto it=G.begin_all_matching_edges(curr_st.v, r.s[curr_st.i]); it!=G.end_all_matching_edges(); ++it) {
             const edge_t e = *it;
-            try_edge(r, curr_st, p, pe, algo, Q, e);
+            try_edge(r, curr_st, p, pe, e);
         }
+        perf.expand.stop();
+        push_next(astar, Q);
     }
 
     if (final_states.empty()) {
@@ -85,10 +120,82 @@ std::vector<state_t> Aligner::readmap(const read_t &r, std::string algo, int max
     return final_states;
 }
 
-void Aligner::try_edge(const read_t &r, const state_t &curr, path_t &p, prev_edge_t &pe, const std::string &algo, queue_t &Q, const edge_t &e) {
+bool Aligner::start_from_prefix(const read_t &r, queue_t &Q) {
+    if (params.prefix_cache_size == 0 || params.prefix_len >= r.len || params.costs.ins <= 0)
+        return false;
+
+    prefix_ = r.s.substr(0, params.prefix_len);
+    const cached_search_t *cached = prefix_cache_.get(prefix_);
+    if (cached) {
+        stats.prefix_cache_hits.inc();
+        search_ = cached->search;
+    } else {
+        search_ = std::make_shared<PrefixSearch>();
+        state_t root(0.0, 0, 0, -1, -1);
+        search_->p[std::make_pair(0, 0)] = root;
+        search_->pe[std::make_pair(0, 0)] = edge_t();
+        search_->Q.push(score_state_t(0.0, root));
+        prefix_cache_.put(prefix_, cached_search_t{search_});
+    }
+
+    push(Q, 0.0, state_t(0.0, 0, PREFIX_SENTINEL, -1, -1));
+    return true;
+}
+
+template<typename H>
+void Aligner::push_prefix_frontier(H *astar, const read_t &r, cost_t bound, queue_t &Q) {
+    PrefixSearch &S = *search_;
+    if (bound > S.bound) {
+        while (!S.Q.empty() && S.Q.top().first <= bound) {
+            state_t curr = S.Q.top().second;
+            S.Q.pop();
+            if (curr.cost > S.p[std::make_pair(curr.i, curr.v)].cost)
+                continue;  // improved since pushed
+
+            if (curr.i == params.prefix_len || !G.node_in_trie(curr.v)) {
+                S.frontier.push_back(curr);
+                continue;
+            }
+            for (auto it=G.begin_all_matching_edges(curr.v, r.s[curr.i]); it!=G.end_all_matching_edges(); ++it) {
+                const edge_t e = *it;
+                if (e.label != EPS && !label_matches(e.label, r.s[curr.i]))
+                    continue;
+                pos_t i_next = (e.label != EPS) ? curr.i+1 : curr.i;
+                state_t next(curr.cost + params.costs.edge2score(e), i_next, e.to, curr.i, curr.v);
+                if (next.cost <= params.max_align_cost && S.p[std::make_pair(i_next, e.to)].optimize(next)) {
+                    S.pe[std::make_pair(i_next, e.to)] = e;
+                    S.Q.push(score_state_t(next.cost, next));
+                }
+            }
+        }
+        S.bound = bound;
+        prefix_cache_.update_size(prefix_);
+    }
+
+    // The frontier states in order of cost up to the bound, as if they were reached from the root.
+    for (; frontier_pushed_ < S.frontier.size() && S.frontier[frontier_pushed_].cost <= bound; frontier_pushed_++) {
+        const state_t &next = S.frontier[frontier_pushed_];
+        if (get_path(p, next.i, next.v).optimize(next)) {
+            set_prev_edge(pe, next.i, next.v, S.pe[std::make_pair(next.i, next.v)]);
+            next_.push_back(next);
+        }
+    }
+    push_next(astar, Q);
+
+    // The states of higher cost are pushed once the aligner reaches their cost.
+    cost_t next = INF;
+    if (frontier_pushed_ < S.frontier.size())
+        next = S.frontier[frontier_pushed_].cost;
+    if (!S.Q.empty())
+        next = std::min(next, S.Q.top().first);
+    if (next != INF)
+        push(Q, next, state_t(next, 0, PREFIX_SENTINEL, -1, -1));
+}
+
+void Aligner::try_edge(const read_t &r, const state_t &curr, path_t &p, prev_edge_t &pe, const edge_t &e) {
     cost_t edge_cost = params.costs.edge2score(e);
 
-    if (e.label != EPS && e.label != r.s[curr.i])
+    if (e.label != EPS && !label_matches(e.label, r.s[curr.i]))
         return;
     
     pos_t i_next = (e.label != EPS) ? curr.i+1 : curr.i;      // Move zero or one positions in the read.
@@ -102,25 +209,42 @@ void Aligner::try_edge(const read_t &r, const state_t &curr, path_t &p, prev_edg
     if (get_path(p, i_next, e.to).optimize(next)) {
         set_prev_edge(pe, i_next, e.to, e);
 
-        stats.t.astar.start();
-        cost_t h = astar->h(next);
-        stats.t.astar.stop();
-
-        cost_t f = g + h;
-
         LOG_DEBUG << "From (" << curr.i << ", " << curr.v << ") "
             << "through edge (" << e.label << ", " << edgeType2str(e.type) << ") "
-            << "push (" << next.i << ", " << next.v << ") with f=g+h = " << g << " + " << h << " = " << f;
-        push(Q, f, next);
+            << "reach (" << next.i << ", " << next.v << ") with g = " << g;
+        next_.push_back(next);
     }
 }
 
+template<typename H>
+void Aligner::push_next(H *astar, queue_t &Q) {
+    if (next_.empty())
+        return;
+
+    next_h_.resize(next_.size());
+    stats.t.astar.start();
+    perf.astar.start();
+    astar->h_batch(next_.data(), next_.size(), next_h_.data());
+    perf.astar.stop();
+    stats.t.astar.stop();
+
+    perf.queue.start();
+    for (size_t k=0; k<next_.size(); k++) {
+        cost_t f = next_[k].cost + next_h_[k];
+        LOG_DEBUG << "push (" << next_[k].i << ", " << next_[k].v << ") with f=g+h = " << next_[k].cost << " + " << next_h_[k] << " = " << f;
+        push(Q, f, next_[k]);
+    }
+    perf.queue.stop();
+    next_.clear();
+}
+
 // Greedy fast-forward exact matching
-state_t Aligner::proceed_identity(path_t &p, prev_edge_t &pe, state_t curr, const read_t &r) {
+template<typename H>
+state_t Aligner::proceed_identity(H *astar, path_t &p, prev_edge_t &pe, state_t curr, const read_t &r) {
     stats.t.ff.start();
 
     edge_t e; 
-    while (G.numOutOrigEdges(curr.v, &e) == 1 && curr.i < r.len-1 && e.label == r.s[curr.i]) {
+    while (G.numOutOrigEdges(curr.v, &e) == 1 && curr.i < r.len-1 && label_matches(e.label, r.s[curr.i])) {
         stats.greedy_matched.inc();
         state_t next = state_t(curr.cost + params.costs.edge2score(e), curr.i+1, e.to, curr.i, curr.v); 
         if (get_path(p, next.i, next.v).optimize(next)) {
@@ -132,10 +256,20 @@ state_t Aligner::proceed_identity(path_t &p, prev_edge_t &pe, state_t curr, cons
 
         curr = next;
         stats.explored_states.inc();
+        astar->on_expand(curr);
     }
 
     stats.t.ff.stop();
     return curr;
 }
 
+// The search for each heuristic (see Aligner::set_heuristic); AStarHeuristic for any other one.
+template std::vector<state_t> Aligner::search<AStarHeuristic>(const read_t &r, int max_best_alignments);
+template std::vector<state_t> Aligner::search<DijkstraDummy>(const read_t &r, int max_best_alignments);
+template std::vector<state_t> Aligner::search<AStarPrefix>(const read_t &r, int max_best_alignments);
+template std::vector<state_t> Aligner::search<AStarSeedsWithErrors>(const read_t &r, int max_best_alignments);
+
+// The greedy matching on its own, for the microbenchmarks (see microbench.cpp).
+template state_t Aligner::proceed_identity<DijkstraDummy>(DijkstraDummy *astar, path_t &p, prev_edge_t &pe, state_t curr, const read_t &r);
+
 }
@@ -6,10 +6,12 @@
 #include <string>
 #include <queue>
 #include <map>
+#include <memory>
 //#include <sparsehash/sparse_hash_map>
 #include <unordered_map>
 
 #include "graph.h"
+#include "perf-counters.h"
 #include "utils.h"
 
 #include <plog/Log.h>
@@ -29,6 +31,8 @@ struct Stats {
     Counter<> popped_trie, popped_ref;
     Counter<> explored_states;
     Counter<> repeated_visits;
+    Counter<> reevaluated;         // popped states pushed back because their heuristic increased
+    Counter<> prefix_cache_hits;   // reads starting from a cached search of the trie
     AlignerTimers t;
 
     struct AlignStatus {
@@ -67,6 +71,8 @@ struct Stats {
         popped_ref.clear();
         explored_states.clear();
         repeated_visits.clear();
+        reevaluated.clear();
+        prefix_cache_hits.clear();
         align_status.clear();
         t.clear();
 
@@ -81,6 +87,8 @@ struct Stats {
         popped_ref += b.popped_ref;
         explored_states += b.explored_states;
         repeated_visits += b.repeated_visits;
+        reevaluated += b.reevaluated;
+        prefix_cache_hits += b.prefix_cache_hits;
         align_status += b.align_status;
         t += b.t;
 
@@ -98,16 +106,22 @@ struct AlignParams {
     const EditCosts &costs;
     const bool greedy_match;
     const cost_t max_align_cost;
+    const int prefix_cache_size;   // maximal number of states in the searches cached by read prefix (0 for no cache)
+    const int prefix_len;          // length of the read prefixes to cache the search of the trie for
 
-    AlignParams(const EditCosts &_costs, const bool _fast_forward, const cost_t _max_align_cost)
+    AlignParams(const EditCosts &_costs, const bool _fast_forward, const cost_t _max_align_cost,
+            const int _prefix_cache_size=0, const int _prefix_len=0)
       : costs(_costs),
         greedy_match(_fast_forward),
-        max_align_cost(_max_align_cost) {
+        max_align_cost(_max_align_cost),
+        prefix_cache_size(_prefix_cache_size),
+        prefix_len(_prefix_len) {
     }
 
     void print() const {
         LOG_INFO << "Params: ";
         LOG_INFO << "  greedy_match  = " << greedy_match;
+        LOG_INFO << "  prefix_cache  = " << prefix_cache_size << " states for prefixes of length " << prefix_len;
         LOG_INFO << "Edit costs: ";
         LOG_INFO << "  match_cost    = " << (int)costs.match;
         LOG_INFO << "  mismatch_cost = " << (int)costs.subst;
@@ -125,6 +139,43 @@ class Aligner {
     typedef std::unordered_map<std::pair<pos_t,node_t>, edge_t, pairhash> prev_edge_t;
     typedef std::unordered_map<std::pair<pos_t,node_t>, bool, pairhash> visited_t;
 
+    // Dijkstra from the trie root over the states which depend only on the first `prefix_len` letters
+    // of a read: the states (i, v) with i < prefix_len and v in the trie. It is shared by the reads
+    // with the same prefix and continued on demand: all states of cost at most `bound` are final.
+    // The other states reached (after the prefix or in the reference) form the frontier from which
+    // the aligner continues.
+    struct PrefixSearch {
+        path_t p;
+        prev_edge_t pe;
+        queue_t Q;                          // states to expand, possibly improved since
+        std::vector<state_t> frontier;      // by nondecreasing cost
+        cost_t bound;
+
+        PrefixSearch() : bound(-1) {}
+
+        size_t size() const {
+            return p.size();
+        }
+    };
+
+    struct cached_search_t {
+        std::shared_ptr<PrefixSearch> search;
+
+        size_t size() const {
+            return search->size();
+        }
+    };
+
+    LRUCache<std::string, cached_search_t> prefix_cache_;
+    std::string prefix_;                    // of the current read, if cached
+    std::shared_ptr<PrefixSearch> search_;  // for the current read
+    size_t frontier_pushed_;                // frontier states of search_ pushed for the current read
+
+    static const node_t PREFIX_SENTINEL = -1;  // a queue element standing for the frontier states not pushed yet
+
+    std::vector<state_t> next_;             // improved successors of the expanded state, to be pushed
+    std::vector<cost_t> next_h_;            // their heuristic, evaluated in one batch
+
   public:
     // Local vars
     path_t p;
@@ -134,9 +185,23 @@ class Aligner {
     AStarHeuristic *astar;    // Concurrent Aligner's can read and write to the same AStar (it computes and memoizes heuristics).
 
     mutable Stats stats;
+    AlignerPerf perf;         // Over all reads; counting only if given counters (see set_counters).
 
-    Aligner(const graph_t &_G, const AlignParams &_params, AStarHeuristic *_astar)
-            : G(_G), params(_params), astar(_astar) {
+  private:
+    // The search specialized for the type of the heuristic (see set_heuristic).
+    std::vector<state_t> (Aligner::*search_fn_)(const read_t &r, int max_best_alignments);
+
+  public:
+    Aligner(const graph_t &_G, const AlignParams &_params)
+            : G(_G), params(_params), prefix_cache_(_params.prefix_cache_size), frontier_pushed_(0), astar(nullptr), search_fn_(nullptr) {
+    }
+
+    // Uses the heuristic of type H, which the search then calls without virtual dispatch (and inlines
+    // if H is final and defined in its header). The search is instantiated in align.cpp.
+    template<typename H>
+    void set_heuristic(H *_astar) {
+        astar = _astar;
+        search_fn_ = &Aligner::search<H>;
     }
 
     inline const graph_t& graph() const {
@@ -152,6 +217,9 @@ class Aligner {
 		p.clear();
 		pe.clear();
 		vis.clear();
+		prefix_.clear();
+		search_.reset();
+		frontier_pushed_ = 0;
 
 		stats.clear();
 		stats.t.total.start();
@@ -177,6 +245,7 @@ class Aligner {
   
   private:
     inline void push(queue_t &Q, cost_t sort_cost, const state_t &st) {
+        AllocScope scope(ALLOC_QUEUE);
         stats.pushed.inc();
         stats.explored_states.inc();
         //stats.pushed_hist[st.i].inc();
@@ -192,6 +261,11 @@ class Aligner {
 
     inline const state_t& get_const_path(const path_t &p, pos_t i, node_t v) const {
         auto it = p.find(std::make_pair(i, v));
+        if (it == p.end() && search_) {
+            it = search_->p.find(std::make_pair(i, v));
+            assert(it != search_->p.end());
+            return it->second;
+        }
         assert(it != p.end());
         return it->second;
     }
@@ -203,6 +277,11 @@ class Aligner {
 
     inline const edge_t& get_prev_edge(const prev_edge_t &pe, pos_t i, node_t v) const {
         auto it = pe.find(std::make_pair(i, v));
+        if (it == pe.end() && search_) {
+            it = search_->pe.find(std::make_pair(i, v));
+            assert(it != search_->pe.end());
+            return it->second;
+        }
         assert(it != pe.end());
         return it->second;
     }
@@ -227,9 +306,22 @@ class Aligner {
         reverse(best_path->begin(), best_path->end());
     }
 
-    state_t proceed_identity(path_t &p, prev_edge_t &pe, state_t curr, const read_t &r);
+    template<typename H>
+    state_t proceed_identity(H *astar, path_t &p, prev_edge_t &pe, state_t curr, const read_t &r);
+
+    // Starts the search from the cached search of the read prefix, if enabled. Returns false otherwise.
+    bool start_from_prefix(const read_t &r, queue_t &Q);
 
-    void try_edge(const read_t &r, const state_t &curr, path_t &p, prev_edge_t &pe, const std::string &algo, queue_t &Q, const edge_t &e);
+    // Continues the search of the prefix up to the given cost and pushes its new frontier states.
+    template<typename H>
+    void push_prefix_frontier(H *astar, const read_t &r, cost_t bound, queue_t &Q);
+
+    // Collects the successor through e if it improves its state.
+    void try_edge(const read_t &r, const state_t &curr, path_t &p, prev_edge_t &pe, const edge_t &e);
+
+    // Pushes the collected successors after evaluating their heuristic with one h_batch call.
+    template<typename H>
+    void push_next(H *astar, queue_t &Q);
 
     /*** A-star and Dijkstra logic ***
         f(n) = g(n) + h(n)
@@ -239,7 +331,14 @@ class Aligner {
     
         r is a 1-based query
     */
-    std::vector<state_t> readmap(const read_t &r, std::string algo, int max_best_alignments);
+    std::vector<state_t> readmap(const read_t &r, int max_best_alignments) {
+        assert(search_fn_);
+        return (this->*search_fn_)(r, max_best_alignments);
+    }
+
+  private:
+    template<typename H>
+    std::vector<state_t> search(const read_t &r, int max_best_alignments);
 };
 
 }
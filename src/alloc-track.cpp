@@ -0,0 +1,143 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "alloc-track.h"
+
+namespace astarix {
+
+const char *alloc_tag_names[ALLOC_TAGS] = {
+    "other", "graph", "trie", "state_table", "queue", "crumbs", "prefix_memo", "reads", "output"
+};
+
+#ifdef TRACK_ALLOCS
+
+thread_local alloc_tag_t current_alloc_tag = ALLOC_OTHER;
+
+// Plain arrays of atomics, which need no construction before the first operator new.
+static std::atomic<uint64_t> allocs[ALLOC_TAGS], bytes[ALLOC_TAGS];
+static std::atomic<int64_t> live_bytes[ALLOC_TAGS], peak_bytes[ALLOC_TAGS];
+
+static void count_alloc(size_t n, alloc_tag_t tag) {
+    allocs[tag].fetch_add(1, std::memory_order_relaxed);
+    bytes[tag].fetch_add(n, std::memory_order_relaxed);
+    int64_t live = live_bytes[tag].fetch_add(n, std::memory_order_relaxed) + n;
+    int64_t peak = peak_bytes[tag].load(std::memory_order_relaxed);
+    while (live > peak && !peak_bytes[tag].compare_exchange_weak(peak, live, std::memory_order_relaxed))
+        ;
+}
+
+static void count_free(size_t n, alloc_tag_t tag) {
+    live_bytes[tag].fetch_sub(n, std::memory_order_relaxed);
+}
+
+alloc_counts_t alloc_counts(alloc_tag_t tag) {
+    return alloc_counts_t{ allocs[tag].load(), bytes[tag].load(), live_bytes[tag].load(), peak_bytes[tag].load() };
+}
+
+uint64_t total_allocs() {
+    uint64_t n = 0;
+    for (int tag=0; tag<ALLOC_TAGS; tag++)
+        n += allocs[tag].load(std::memory_order_relaxed);
+    return n;
+}
+
+alloc_tag_t track_alloc(size_t n) {
+    alloc_tag_t tag = current_alloc_tag;
+    count_alloc(n, tag);
+    return tag;
+}
+
+void track_free(size_t n, alloc_tag_t tag) {
+    count_free(n, tag);
+}
+
+// Each block is preceded by a header with its size and tag, so that it is freed toward the subsystem
+// that allocated it; offset leads back to the start of the block from malloc.
+struct alloc_header_t {
+    size_t size;
+    uint32_t tag;
+    uint32_t offset;
+};
+static_assert(sizeof(alloc_header_t) == 16, "The header should keep the default alignment.");
+
+static void *tracked_alloc(size_t n, size_t align) {
+    size_t offset = align > sizeof(alloc_header_t) ? align : sizeof(alloc_header_t);
+    char *base = static_cast<char*>(align > sizeof(alloc_header_t)
+        ? std::aligned_alloc(align, (offset + n + align - 1) / align * align)
+        : std::malloc(offset + n));
+    if (!base)
+        return nullptr;
+    alloc_header_t *h = reinterpret_cast<alloc_header_t*>(base + offset) - 1;
+    h->size = n;
+    h->tag = current_alloc_tag;
+    h->offset = offset;
+    count_alloc(n, current_alloc_tag);
+    return base + offset;
+}
+
+static void tracked_free(void *p) {
+    if (!p)
+        return;
+    alloc_header_t *h = static_cast<alloc_header_t*>(p) - 1;
+    count_free(h->size, alloc_tag_t(h->tag));
+    std::free(static_cast<char*>(p) - h->offset);
+}
+
+static void *tracked_new(size_t n, size_t align) {
+    void *p = tracked_alloc(n, align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+#else
+
+alloc_counts_t alloc_counts(alloc_tag_t tag) {
+    return alloc_counts_t{ 0, 0, 0, 0 };
+}
+
+uint64_t total_allocs() {
+    return 0;
+}
+
+alloc_tag_t track_alloc(size_t n) {
+    return ALLOC_OTHER;
+}
+
+void track_free(size_t n, alloc_tag_t tag) {
+}
+
+#endif
+
+}
+
+#ifdef TRACK_ALLOCS
+
+using astarix::tracked_new;
+using astarix::tracked_alloc;
+using astarix::tracked_free;
+
+void *operator new(size_t n) { return tracked_new(n, 0); }
+void *operator new[](size_t n) { return tracked_new(n, 0); }
+void *operator new(size_t n, std::align_val_t a) { return tracked_new(n, size_t(a)); }
+void *operator new[](size_t n, std::align_val_t a) { return tracked_new(n, size_t(a)); }
+void *operator new(size_t n, const std::nothrow_t &) noexcept { return tracked_alloc(n, 0); }
+void *operator new[](size_t n, const std::nothrow_t &) noexcept { return tracked_alloc(n, 0); }
+void *operator new(size_t n, std::align_val_t a, const std::nothrow_t &) noexcept { return tracked_alloc(n, size_t(a)); }
+void *operator new[](size_t n, std::align_val_t a, const std::nothrow_t &) noexcept { return tracked_alloc(n, size_t(a)); }
+
+void operator delete(void *p) noexcept { tracked_free(p); }
+void operator delete[](void *p) noexcept { tracked_free(p); }
+void operator delete(void *p, size_t) noexcept { tracked_free(p); }
+void operator delete[](void *p, size_t) noexcept { tracked_free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { tracked_free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { tracked_free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { tracked_free(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { tracked_free(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { tracked_free(p); }
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace astarix {
+
+// Heap allocations (operator new and the mapped graph arrays) counted by the subsystem they are made
+// for. Built only with TRACK_ALLOCS (make TRACK_ALLOCS=1), which replaces the global operator new;
+// otherwise AllocScope is empty and all the counts are 0.
+enum alloc_tag_t {
+    ALLOC_OTHER=0, ALLOC_GRAPH, ALLOC_TRIE, ALLOC_STATE_TABLE, ALLOC_QUEUE, ALLOC_CRUMBS, ALLOC_PREFIX_MEMO,
+    ALLOC_READS, ALLOC_OUTPUT, ALLOC_TAGS
+};
+
+extern const char *alloc_tag_names[ALLOC_TAGS];  // e.g. "state_table"
+
+#ifdef TRACK_ALLOCS
+const bool TRACKING_ALLOCS = true;
+#else
+const bool TRACKING_ALLOCS = false;
+#endif
+
+struct alloc_counts_t {
+    uint64_t allocs;      // number of allocations
+    uint64_t bytes;       // allocated in total
+    int64_t live_bytes;   // not freed yet (may be negative if memory of another subsystem is freed)
+    int64_t peak_bytes;   // maximal live_bytes
+};
+
+alloc_counts_t alloc_counts(alloc_tag_t tag);
+uint64_t total_allocs();  // over all subsystems
+
+#ifdef TRACK_ALLOCS
+extern thread_local alloc_tag_t current_alloc_tag;
+#endif
+
+// For memory not from operator new (see map_pages), freed toward the subsystem that allocated it.
+alloc_tag_t track_alloc(size_t bytes);
+void track_free(size_t bytes, alloc_tag_t tag);
+
+// The allocations of the calling thread during the lifetime of the scope are counted for the tag,
+// unless a nested scope says otherwise.
+class AllocScope {
+#ifdef TRACK_ALLOCS
+    alloc_tag_t prev_;
+
+  public:
+    explicit AllocScope(alloc_tag_t tag) : prev_(current_alloc_tag) {
+        current_alloc_tag = tag;
+    }
+
+    ~AllocScope() {
+        current_alloc_tag = prev_;
+    }
+#else
+  public:
+    explicit AllocScope(alloc_tag_t tag) {}
+#endif
+    AllocScope(const AllocScope &) = delete;
+    AllocScope& operator=(const AllocScope &) = delete;
+};
+
+}
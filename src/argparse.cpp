@@ -8,14 +8,26 @@ struct argp_option options[] = {
     { "outdir",         'o', "OUTDIR",        0,  "Output directory" },
     { "tree_depth",     'D', "TREE_DEPTH",    0,  "Suffix tree depth" },
     { "fixed_trie_depth",1001, "FIXED_TRIE_DEPTH",    0,  "Some leafs depth can be less than tree_depth (variable=0, fixed=1)" },
+    { "fm_index",       1002, "{0,1}",         0,  "Replace the fixed-depth trie of a linear reference by an FM-index [0]" },
+    { "lazy_trie",      1003, "MAX_GB",        0,  "Build the fixed-depth trie while aligning, keeping up to MAX_GB of reference nodes to continue from (0 to build it in advance) [0]" },
+    { "memory_budget",  1004, "GB",            0,  "Choose the trie depth and layout and the heuristic caches that are not given to fit the memory budget (0 for no budget) [0]" },
+    { "prefix_cache",   1005, "STATES",        0,  "Maximal number of states of the trie searches cached by read prefix, which pays off for repeated prefixes or heuristics weak in the trie (0 for no cache) [0]" },
+    { "prefix_cache_len", 1006, "LEN",         0,  "Length of the read prefixes to cache the search of the trie for [trie depth]" },
+    { "huge_pages",     1008, "{0,1,2}",       0,  "Place the graph arrays on huge pages: none=0, transparent=1, explicit=2 (from the reserved pool, else transparent) [0]" },
+    { "numa_node",      1009, "NODE",          0,  "Bind the graph arrays and pin the aligner to a NUMA node (-1 for the default placement) [-1]" },
+    { "perf_counters",  1010, "{0,1}",         0,  "Count cycles, instructions, LLC, dTLB and branch misses per phase and alignment part into stats.log [0]" },
+    { "reorder_nodes",  1007, "{0,1}",         0,  "Renumber the reference nodes in breadth-first order for memory locality (changes the node ids in the output) [0]" },
     { "algorithm",      'a', "{dijkstra, astar-prefix, astar-seeds}", 0, "Shortest path algorithm" },
     { "greedy_match",   'f', "GREEDY_MATCH",  0,  "Proceed greedily forward if there is a unique matching outgoing edge" },
     { "prefix_len_cap",  'd', "A*_PREFIX_CAP", 0,  "The upcoming sequence length cap for the A* heuristic" },
     { "prefix_cost_cap", 'c', "A*_COST_CAP",   0,  "The maximum prefix cost for the A* heuristic" },
     { "prefix_equivalence_classes",
                         'e', "A*_EQ_CLASSES", 0, "Whether to partition all nodes to equivalence classes in order not to reuse the heuristic" },
-    { "seeds_len",  					2001, "A*_SEED_LEN", 0,  "The length of the A* seeds." },
+    { "seeds_len",  					2001, "A*_SEED_LEN", 0,  "The length of the A* seeds [auto per read]" },
+    { "seeds_max_matches",  			2010, "MAX_MATCHES", 0,  "Lengthen or drop seeds with more matches (0 for no limit) [0]" },
+    { "seeds_crumb_cache",  			2011, "RANGES", 0,  "Maximal number of crumbed node ranges cached across reads (0 for no cache; up to 10000000 by --memory_budget) [0]" },
     { "seeds_skip_near_crumbs",  		2008, "{0,1}", 0,  "" },
+    { "seeds_match_pruning",  			2009, "{0,1}", 0,  "Prune the crumbs of a seed match once its start is expanded [0]" },
     { "match",          'M', "MATCH_COST",   0,  "Match penalty [0]" },
     { "subst",          'S', "SUBST_COST",   0,  "Substitution penalty [1]" },
     { "gap",            'G', "GAP_COST",     0,  "Gap (Insertion or Deletion) penalty [5]" },
@@ -32,7 +44,8 @@ const char *argp_program_bug_address = "<ivanov@pesho.info>";
 static char doc[] = "Optimal sequence-to-graph aligner based on A* shortest path.";
 
 /* A description of the arguments we accept. */
-static char args_doc[] = "align-optimal -g GRAPH.gfa -q READS.fq -o OUT_DIR/";
+static char args_doc[] = "align-optimal -g GRAPH.gfa -q READS.fq -o OUT_DIR/\n"
+                         "microbench -g GRAPH.gfa -q READS.fq -o OUT_DIR/";
 
 static struct argp argp = { options, parse_opt, args_doc, doc };
 
@@ -53,6 +66,15 @@ arguments read_args(int argc, char **argv) {
     args.algorithm             = (char *)"astar-prefix";
     args.tree_depth            = -1;              // auto mode
     args.fixed_trie_depth      = false;           // leafs can be shallower if `true`
+    args.fm_index              = false;
+    args.lazy_trie_gb          = 0.0;
+    args.memory_budget_gb      = 0.0;             // no budget
+    args.prefix_cache_size     = 0;
+    args.prefix_cache_len      = -1;              // the trie depth
+    args.reorder_nodes         = false;
+    args.huge_pages            = astarix::HUGE_PAGES_OFF;
+    args.numa_node             = -1;              // default placement
+    args.perf_counters         = false;
     args.AStarLengthCap        = 5;
     args.AStarCostCap          = 5;
     args.threads               = 1;
@@ -63,6 +85,9 @@ arguments read_args(int argc, char **argv) {
 
     args.astar_seeds.seed_len              	= -1;
 	args.astar_seeds.skip_near_crumbs		= true;
+	args.astar_seeds.match_pruning			= false;
+	args.astar_seeds.max_seed_matches		= 0;
+	args.astar_seeds.crumb_cache_size		= 0;
 
     args.verbose               = 0;
     args.command               = (char *)"align-optimal";
@@ -95,6 +120,7 @@ error_t parse_opt (int key, char *arg, struct argp_state *state) {
     /* Get the input argument from argp_parse, which we
        know is a pointer to our arguments structure. */
     struct arguments *arguments = (struct arguments *)(state->input);
+    arguments->given.insert(key);
   
     switch (key) {
         case 'g':
@@ -109,6 +135,39 @@ error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 1001:
             arguments->fixed_trie_depth = (bool)std::stod(arg);
             break;
+        case 1002:
+            arguments->fm_index = (bool)std::stod(arg);
+            break;
+        case 1003:
+            if (!(std::stod(arg) >= 0.0)) throw "The lazy trie memory should be non-negative.";
+            arguments->lazy_trie_gb = std::stod(arg);
+            break;
+        case 1004:
+            if (!(std::stod(arg) >= 0.0)) throw "The memory budget should be non-negative.";
+            arguments->memory_budget_gb = std::stod(arg);
+            break;
+        case 1005:
+            if (!(std::stoi(arg) >= 0)) throw "Prefix cache size should be non-negative.";
+            arguments->prefix_cache_size = std::stoi(arg);
+            break;
+        case 1006:
+            if (!(std::stoi(arg) >= 1)) throw "Prefix cache length should be positive.";
+            arguments->prefix_cache_len = std::stoi(arg);
+            break;
+        case 1007:
+            arguments->reorder_nodes = (bool)std::stod(arg);
+            break;
+        case 1008:
+            if (!(std::stoi(arg) >= 0 && std::stoi(arg) <= 2)) throw "Huge pages should be 0, 1 or 2.";
+            arguments->huge_pages = (astarix::huge_pages_t)std::stoi(arg);
+            break;
+        case 1009:
+            if (!(std::stoi(arg) >= -1)) throw "NUMA node should be non-negative or -1.";
+            arguments->numa_node = std::stoi(arg);
+            break;
+        case 1010:
+            arguments->perf_counters = (bool)std::stod(arg);
+            break;
         case 'a':
             //assert(std::strcmp(arg, "dijkstra") == 0 || std::strcmp(arg, "astar-prefix") == 0);
             arguments->algorithm = arg;
@@ -138,6 +197,17 @@ error_t parse_opt (int key, char *arg, struct argp_state *state) {
         case 2008:
             arguments->astar_seeds.skip_near_crumbs = (bool)std::stod(arg);
             break;
+        case 2009:
+            arguments->astar_seeds.match_pruning = (bool)std::stod(arg);
+            break;
+        case 2010:
+            if (!(std::stoi(arg) >= 0)) throw "Max seed matches should be non-negative.";
+            arguments->astar_seeds.max_seed_matches = std::stoi(arg);
+            break;
+        case 2011:
+            if (!(std::stoi(arg) >= 0)) throw "Crumb cache size should be non-negative.";
+            arguments->astar_seeds.crumb_cache_size = std::stoi(arg);
+            break;
         case 'o':
             arguments->output_dir = arg;
             break;
@@ -151,6 +221,9 @@ error_t parse_opt (int key, char *arg, struct argp_state *state) {
             arguments->costs.ins = std::stod(arg);
             arguments->costs.del = std::stod(arg);
             break;
+        case 'm':
+            arguments->maxAlignmentCost = std::stoi(arg);
+            break;
         case 'k':
             arguments->k_best_alignments = std::stod(arg);
             break;
@@ -164,7 +237,8 @@ error_t parse_opt (int key, char *arg, struct argp_state *state) {
             // Too many arguments.
             if (state->arg_num >= 3)
                 argp_usage(state);
-            if (std::strcmp(arg, "align-optimal") != 0) throw "align-optimal is a necessary command.";
+            if (std::strcmp(arg, "align-optimal") != 0 && std::strcmp(arg, "microbench") != 0)
+                throw "align-optimal or microbench is a necessary command.";
             arguments->command = arg;
             break;
   
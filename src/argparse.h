@@ -4,9 +4,11 @@
 #include <cassert>
 #include <cstring>
 #include <map>
+#include <set>
 #include <string>
 
 #include "astar-seeds.h"
+#include "page-alloc.h"
 #include "utils.h"
 
 // based on http://www.gnu.org/software/libc/manual/html_node/Argp-Example-3.html#Argp-Example-3
@@ -33,6 +35,15 @@ struct arguments {
     bool greedy_match;
     int tree_depth;
     bool fixed_trie_depth;
+    bool fm_index;
+    double lazy_trie_gb;
+    double memory_budget_gb;
+    int prefix_cache_size;
+    int prefix_cache_len;
+    bool reorder_nodes;
+    astarix::huge_pages_t huge_pages;
+    int numa_node;
+    bool perf_counters;
     int threads;
 
     // A*-prefix params
@@ -44,6 +55,7 @@ struct arguments {
     // Debug
     int verbose;
     char *command;
+    std::set<int> given;    // keys of the options given on the command line
 };
 
 error_t parse_opt (int key, char *arg, struct argp_state *state);
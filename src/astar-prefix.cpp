@@ -3,13 +3,13 @@
 
 namespace astarix {
 
-bool AStarPrefix::is_linear(int u, int rem_len, std::string *pref, int *boundary_node) const {
+bool AStarPrefix::is_linear(node_t u, int rem_len, std::string *pref, node_t *boundary_node) const {
     if (rem_len == 0) {
         (*boundary_node) = u;
         return true;
     }
 
-    int v=-1;
+    node_t v=-1;
     char c;
     for (auto it=G.begin_orig_edges(u); it!=G.end_orig_edges(); ++it) {
         const edge_t &e = *it;
@@ -21,12 +21,15 @@ bool AStarPrefix::is_linear(int u, int rem_len, std::string *pref, int *boundary
 
     if (v == -1)                                        // zero neighbours
         return false;
+    if (graph_t::nucl_index(c) == -1)                   // a subset of nucleotides
+        return false;
 
     (*pref) += c;
     return is_linear(v, rem_len-1, pref, boundary_node);
 }
 
 int AStarPrefix::precompute_A_star_prefix() {
+    AllocScope scope(ALLOC_PREFIX_MEMO);
     LOG_INFO << "A* precomputation...";
     assert(_star.empty());
 
@@ -36,19 +39,19 @@ int AStarPrefix::precompute_A_star_prefix() {
     hash_precomp();                                     // computed kMaxStrHash
     assert(kMaxStrHash != -1);
 
-    std::vector<int> strhash2class(kMaxStrHash, -1);    // internal hashing: a hash of a prefix of a linear part of the graph to a representative vertex with a computed future
+    std::vector<node_t> strhash2class(kMaxStrHash, -1);    // internal hashing: a hash of a prefix of a linear part of the graph to a representative vertex with a computed future
 
     classes = 0;
 
     // nodes compressed to classes of equivalence
-    for (int u=0; u<G.nodes(); u++) {
+    for (node_t u=0; u<G.nodes(); u++) {
         std::string pref;
-        int boundary_node=-1;
+        node_t boundary_node=-1;
         if (compress_vertices && is_linear(u, max_prefix_len, &pref, &boundary_node)) {
             ++compressable_vertices;
             auto h = hash_str(pref);
             assert((size_t)h < strhash2class.size());
-            int &cl = strhash2class[h];             // representative vertex
+            node_t &cl = strhash2class[h];             // representative vertex
             if (cl == -1) {                         // if this is the first vertex with seen from this class
                 cl = classes++;
                 _class2repr.push_back(u);
@@ -56,7 +59,7 @@ int AStarPrefix::precompute_A_star_prefix() {
             }
             _vertex2class[u] = cl;                  // to be used for quering
         } else {
-            int cl = classes++;
+            node_t cl = classes++;
             _class2repr.push_back(u);
             _class2boundary.push_back(-1);
             _vertex2class[u] = cl;   
@@ -80,8 +83,8 @@ int AStarPrefix::precompute_A_star_prefix() {
 }
 
 void AStarPrefix::compute_astar_cost_from_vertex_and_prefix(
-        cost_t &res, int u, const std::string &prefix,
-        int boundary_node, int i, cost_t prev_cost) const {
+        cost_t &res, node_t u, const std::string &prefix,
+        node_t boundary_node, int i, cost_t prev_cost) const {
     if ((size_t)i >= prefix.size() || u == boundary_node) {
         if (prev_cost < res) {
             res = prev_cost;
@@ -99,7 +102,8 @@ void AStarPrefix::compute_astar_cost_from_vertex_and_prefix(
     }
 }
 
-cost_t AStarPrefix::lazy_star_value(unsigned h, int repr, int boundary_node, const std::string &prefix) const {
+cost_t AStarPrefix::lazy_star_value(unsigned h, node_t repr, node_t boundary_node, const std::string &prefix) const {
+    AllocScope scope(ALLOC_PREFIX_MEMO);
     LOG_DEBUG << "Lazy A* query for h=" << h << ", repr=" << repr << ", boundary_node=" << boundary_node << ", prefix=" << prefix;
 
     ++_cache_trees;
@@ -117,25 +121,46 @@ cost_t AStarPrefix::lazy_star_value(unsigned h, int repr, int boundary_node, con
     return it->second;
 }
 
-cost_t AStarPrefix::astar_from_pos(int v, const std::string &prefix) const {
+cost_t AStarPrefix::astar_from_pos(node_t v, const std::string &prefix) const {
+    return astar_from_pos(v, prefix, hash_str(prefix));
+}
+
+cost_t AStarPrefix::astar_from_pos(node_t v, const std::string &prefix, unsigned prefix_hash) const {
     LOG_DEBUG << "v=" << v << ", prefix=" << prefix;
-    assert(v < (int)_vertex2class.size());
-    int cl = _vertex2class[v];
-    auto h = hash(prefix, cl);
-    assert(cl < (int)_class2repr.size());
-    int repr = _class2repr[cl];
-    assert(cl < (int)_class2boundary.size());
-    int boundary_node = _class2boundary[cl];
+    assert(v < (node_t)_vertex2class.size());
+    node_t cl = _vertex2class[v];
+    unsigned h = prefix_hash + cl*kMaxStrHash;
+    assert(h == hash(prefix, cl));
+    assert(cl < (node_t)_class2repr.size());
+    node_t repr = _class2repr[cl];
+    assert(cl < (node_t)_class2boundary.size());
+    node_t boundary_node = _class2boundary[cl];
     return lazy_star_value(h, repr, boundary_node, prefix);
 }
 
-cost_t AStarPrefix::h(const state_t &st) const {
-    std::string prefix = r->s.substr(st.i, max_prefix_len);
+std::string AStarPrefix::prefix_at(pos_t i) const {
+    std::string prefix = r->s.substr(i, max_prefix_len);
 
     LOG_FATAL_IF(prefix.length() > (size_t)max_prefix_len)
         << "The prefix " << prefix << " with length " << prefix.length() << " should be shorter than " << max_prefix_len;
     assert(prefix.length() <= (size_t)max_prefix_len);
-    return astar_from_pos(st.v, prefix);
+    return prefix;
+}
+
+cost_t AStarPrefix::h(const state_t &st) const {
+    return astar_from_pos(st.v, prefix_at(st.i));
+}
+
+void AStarPrefix::h_batch(const state_t *st, size_t n, cost_t *hs) const {
+    std::string prefix;
+    unsigned prefix_hash = 0;
+    for (size_t k=0; k<n; k++) {
+        if (k == 0 || st[k].i != st[k-1].i) {
+            prefix = prefix_at(st[k].i);
+            prefix_hash = hash_str(prefix);
+        }
+        hs[k] = astar_from_pos(st[k].v, prefix, prefix_hash);
+    }
 }
 
 //cost_t AStarPrefix::h(int v, const std::string &prefix) {
@@ -10,7 +10,7 @@
 
 namespace astarix {
 
-class AStarPrefix: public AStarHeuristic {
+class AStarPrefix final: public AStarHeuristic {
   private:
     // General params
     const graph_t &G;
@@ -33,16 +33,16 @@ class AStarPrefix: public AStarHeuristic {
 
     // Auxiliary structs
     std::vector<unsigned> _prev_group_sum;          // string length -> number of strings with strictly lower length
-    std::vector<int> _vertex2class;                 // vertex to a representative equivalent vertex for which future is calculated
-    std::vector<int> _class2repr;                   // used for `decompresion'
-    std::vector<int> _class2boundary;
+    std::vector<node_t> _vertex2class;               // vertex to a representative equivalent vertex for which future is calculated
+    std::vector<node_t> _class2repr;                // used for `decompresion'
+    std::vector<node_t> _class2boundary;
     unsigned _nucl_num[256];
     mutable int _cache_trees, _cache_misses;
 
-    int classes;                                    // number of equivalence classes
+    node_t classes;                                 // number of equivalence classes
 
     // Currently calculated
-    int compressable_vertices;
+    node_t compressable_vertices;
 
     mutable std::atomic<int> _entries;
 
@@ -83,6 +83,9 @@ class AStarPrefix: public AStarHeuristic {
 
     cost_t h(const state_t &st) const;
 
+    // The successors at the same read position share the prefix and its hash.
+    void h_batch(const state_t *st, size_t n, cost_t *hs) const;
+
     void print_params(std::ostream &out) const {
         out << "                   Cost cap: " << (int)max_prefix_cost                       << std::endl;
         out << "   Upcoming seq. length cap: " << max_prefix_len                         << std::endl;
@@ -107,7 +110,7 @@ class AStarPrefix: public AStarHeuristic {
         return max_prefix_cost;
     }
 
-    int get_compressable_vertices() const {
+    node_t get_compressable_vertices() const {
         return compressable_vertices;
     }
 
@@ -141,18 +144,22 @@ class AStarPrefix: public AStarHeuristic {
 
     // returns true if there is a unique ORIG path from u with length rem_len; postcond: pref is the spelling of this path
     // returns false otherwise
-    bool is_linear(int u, int rem_len, std::string *pref, int *boundary_node) const;
+    bool is_linear(node_t u, int rem_len, std::string *pref, node_t *boundary_node) const;
 
     // computes the minimum cost for matching the remining read (prefix[i:]) from u
     void compute_astar_cost_from_vertex_and_prefix(
-            cost_t &res, int u, const std::string &prefix, int boundary_node,
+            cost_t &res, node_t u, const std::string &prefix, node_t boundary_node,
             int i=0, cost_t prev_cost=0.0) const;
 
     // wrapper around compute_astar_cost_from_vertex_and_prefix dealing with memoization
-    cost_t lazy_star_value(unsigned h, int repr, int boundary_node, const std::string &prefix) const;
+    cost_t lazy_star_value(unsigned h, node_t repr, node_t boundary_node, const std::string &prefix) const;
 
     // translatex (node, prefix) to (hash(eq_class_representative_node(node)), prefix)
-    cost_t astar_from_pos(int v, const std::string &prefix) const;
+    cost_t astar_from_pos(node_t v, const std::string &prefix) const;
+    cost_t astar_from_pos(node_t v, const std::string &prefix, unsigned prefix_hash) const;
+
+    // the prefix of the read to be matched from position i
+    std::string prefix_at(pos_t i) const;
 
     void hash_precomp() {
         int four_power=1;
@@ -14,20 +14,28 @@ typedef short seed_t;
 
 namespace astarix {
 
-class AStarSeedsWithErrors: public AStarHeuristic {
+class AStarSeedsWithErrors final: public AStarHeuristic {
   public:
     // A*-seeds parameters.
     struct Args {
-        int seed_len;
+        int seed_len;                   // -1 for a per-read seed length
+        int max_seed_matches;           // Seeds with more matches are lengthened or dropped (0 for no limit).
 		bool skip_near_crumbs;			// Put crumbs in the trie only for nodes within [-m-delta, -m+delta] instead of [-m-delta, 0].
+		bool match_pruning;				// Ignore the crumbs of a seed match behind the search front once its start is expanded.
+		int crumb_cache_size;			// Maximal number of crumbed node ranges kept across reads (0 for no cache).
     };
 
   private:
     struct Stats {
         Counter<> seeds;                    // number of seeds (depends only on the read)
         Counter<> seed_matches;             // places in the graph where seeds match well enough
+        Counter<> lengthened_seeds;         // seeds lengthened because of too many matches
+        Counter<> dropped_seeds;            // seeds dropped because of too many matches even when lengthened
+        Counter<> crumb_cache_hits;         // seed matches crumbed from the cross-read cache
         Counter<> states_with_crumbs;       // the number of states with crumbs
+        Counter<> crumb_ranges;             // ranges of consecutive nodes storing the crumbs on the reference
         Counter<> repeated_states;          // number of times crumbs are put on a states that already has crumbs
+        Counter<> pruned_matches;           // seed matches pruned during the search
         Counter<cost_t> root_heuristic;     // heuristic from the trie root
         Counter<> heuristic_potential;      // maximal possible heuristic
         Counter<> reads;                    // reads processed
@@ -35,16 +43,26 @@ class AStarSeedsWithErrors: public AStarHeuristic {
         void clear() {
             seeds.clear();
             seed_matches.clear();
+            lengthened_seeds.clear();
+            dropped_seeds.clear();
+            crumb_cache_hits.clear();
             states_with_crumbs.clear();
+            crumb_ranges.clear();
             repeated_states.clear();
+            pruned_matches.clear();
             root_heuristic.clear();
         }
 
         Stats& operator+=(const Stats &b) {
             seeds += b.seeds;
             seed_matches += b.seed_matches;
+            lengthened_seeds += b.lengthened_seeds;
+            dropped_seeds += b.dropped_seeds;
+            crumb_cache_hits += b.crumb_cache_hits;
             states_with_crumbs += b.states_with_crumbs;
+            crumb_ranges += b.crumb_ranges;
             repeated_states += b.repeated_states;
+            pruned_matches += b.pruned_matches;
             root_heuristic += b.root_heuristic;
             heuristic_potential += b.heuristic_potential;
             reads += b.reads;
@@ -55,15 +73,92 @@ class AStarSeedsWithErrors: public AStarHeuristic {
 	struct crumb_t {
 		node_t v;  // Can be both in the trie or not.
 		seed_t s;  // From right to left: the last/rightmost seed has index 0.
+		int m;     // Index of the seed match which put the crumb.
 
 		crumb_t() {}
-		crumb_t(const node_t _v, const seed_t _s)
-			: v(_v), s(_s) {}
+		crumb_t(const node_t _v, const seed_t _s, const int _m=0)
+			: v(_v), s(_s), m(_m) {}
 
 		bool operator<(const crumb_t &other) const {
 			if (v != other.v)
 				return v < other.v;
-			return s < other.s;
+			if (s != other.s)
+				return s < other.s;
+			return m < other.m;
+		}
+
+		bool operator==(const crumb_t &other) const {
+			return v == other.v && s == other.s && m == other.m;
+		}
+	};
+
+	// Consecutive nodes [from, to], e.g. a stretch of a linear reference.
+	struct node_range_t {
+		node_t from, to;
+
+		node_range_t(const node_t _from, const node_t _to)
+			: from(_from), to(_to) {}
+	};
+
+	// Crumbs of one seed match on all nodes of a range.
+	struct crumb_range_t {
+		node_t from, to;
+		seed_t s;
+		int m;
+
+		crumb_range_t(const node_range_t &range, const seed_t _s, const int _m)
+			: from(range.from), to(range.to), s(_s), m(_m) {}
+
+		bool operator<(const crumb_range_t &other) const {
+			return from < other.from;
+		}
+	};
+
+	// The nodes crumbed for a seed match (as ranges); the crumbs of the reference nodes `up` are also propagated up the trie.
+	struct match_crumbs_t {
+		std::vector<node_range_t> ranges;
+		std::vector<node_t> up;
+
+		size_t size() const {
+			return ranges.size() + up.size();
+		}
+	};
+
+	// A seed r[start, start+len) together with the ends of its exact matches in the reverse complement graph.
+	struct seed_occ_t {
+		pos_t start, len;
+		std::vector<node_t> ends;
+	};
+
+	// An exact occurence of a seed in the graph: aligning r[start] from node v starts the match.
+	struct match_t {
+		pos_t start;
+		node_t v;
+
+		match_t(const pos_t _start, const node_t _v)
+			: start(_start), v(_v) {}
+
+		bool operator<(const match_t &other) const {
+			if (start != other.start)
+				return start < other.start;
+			return v < other.v;
+		}
+	};
+
+	// The nodes crumbed for a match depend only on the match node, the read position before it and max_indels.
+	struct crumbs_key_t {
+		node_t v;
+		pos_t i;
+		int max_indels;
+
+		bool operator==(const crumbs_key_t &other) const {
+			return v == other.v && i == other.i && max_indels == other.max_indels;
+		}
+	};
+
+	struct crumbs_key_hash {
+		size_t operator()(const crumbs_key_t &key) const {
+			return (size_t(key.v) * 1000003u + size_t(key.i)) * 1000003u + size_t(key.max_indels);
 		}
 	};
 
@@ -73,53 +168,209 @@ class AStarSeedsWithErrors: public AStarHeuristic {
     const EditCosts &costs;
     const Args args;
 
+	static constexpr double kDefaultErrorRate = 0.01;  // Used for reads without phred values.
+
 	// Read alignment state
 	int seeds_;
     int max_indels_;
-	std::vector<crumb_t> C;   // All crumbs sorted by node, then by seed number.
+	std::vector<seed_t> seeds_after_;   // seeds_after_[i] -- number of seeds starting after read position i
+	std::vector<char> seed_start_;      // seed_start_[i] -- whether a seed starts at read position i
+	std::vector<crumb_t> C;   // Crumbs on single (trie) nodes sorted by node, then by seed number.
+	std::vector<crumb_range_t> R;  // Crumbs on node ranges sorted by range start.
+	node_t max_range_len_;    // The longest range in R.
+	std::vector<crumb_t> U;   // Crumbs on reference nodes to be propagated up the trie.
+	std::vector<match_t> M;   // All seed matches; crumb_t::m indexes M.
+	std::vector<int> M_order; // Indices of M sorted by match start.
+	std::vector<cost_t> pruned; // pruned[m] -- the crumbs of M[m] are ignored by states with at least this cost.
+
+	// Cross-read state
+	LRUCache<crumbs_key_t, match_crumbs_t, crumbs_key_hash> crumbs_cache_;  // The nodes to crumb for each recently matched seed.
+
+	// The trie does not index walks starting with an N (see graph_t::trie_exit), so the seed matches
+	// with the last letter on an N are not found. Instead, h counts all seeds as crumbed on the
+	// reference nodes from which at most near_unknown_dist_ letters lead to an N, and on a trie node the
+	// seeds ending late enough to reach an N after the letters from the node to it.
+	bool has_unknown_;
+	int near_unknown_dist_;
+	std::vector<bool> near_unknown_;                      // reference nodes
+	std::unordered_map<node_t, int> unknown_trie_dist_;   // letters from a trie node to an N, up to near_unknown_dist_
+	std::vector<int> seed_end_;                           // seed_end_[s] -- the last read position of seed s
+
+	mutable std::vector<char> has_crumb_;  // h(): the seeds with a crumb on the state
 
 	// Stats
     Stats read_cnt, global_cnt;
 
   private:
-	// Skip v (which is in the reference) and add crumbs only to the trie.
-    void update_crumbs_up_the_trie(const seed_t s, const node_t match_v, node_t v) {
-		if (v != 0)
+	// The number of seeds after st.i is reduced by the seeds with a crumb on st.v. The searches in C and R
+	// start from c_from and r_from, which are left at the lower bounds for st.v (valid for larger nodes).
+	cost_t h(const state_t &st, std::vector<char> &has_crumb,
+			std::vector<crumb_t>::const_iterator &c_from, std::vector<crumb_range_t>::const_iterator &r_from) const {
+		if (has_unknown_ && !G.node_in_trie(st.v) && near_unknown_[st.v])
+			return (r_->len - st.i)*costs.match;
+
+		int seeds_to_end = seeds_after_[st.i];
+		int missing = seeds_to_end;  // Maximum number of errors.
+
+		has_crumb.assign(seeds_to_end, false);
+		if (has_unknown_ && G.node_in_trie(st.v)) {
+			// Reaching an N takes at least that many letters, of which max_indels_ may be deleted.
+			auto it = unknown_trie_dist_.find(st.v);
+			if (it != unknown_trie_dist_.end())
+				for (int s=0; s<seeds_to_end && seed_end_[s] >= st.i + it->second - max_indels_; s++) {
+					has_crumb[s] = true;
+					--missing;
+				}
+		}
+		auto add_crumb = [&](const seed_t s, const int m) {
+			if (s < seeds_to_end && st.cost < pruned[m] && !has_crumb[s]) {
+				has_crumb[s] = true;
+				--missing;
+			}
+		};
+
+		c_from = std::lower_bound(c_from, C.cend(), crumb_t(st.v, 0));
+		for (auto it=c_from; it != C.end() && it->v == st.v; ++it)
+			add_crumb(it->s, it->m);
+
+		// Only ranges starting at most max_range_len_ before v may contain it.
+		crumb_range_t first(node_range_t(st.v - max_range_len_ + 1, st.v), 0, 0);
+		r_from = std::lower_bound(r_from, R.cend(), first);
+		for (auto it=r_from; it != R.end() && it->from <= st.v; ++it)
+			if (st.v <= it->to)
+				add_crumb(it->s, it->m);
+
+		return (r_->len - st.i)*costs.match + missing*costs.get_delta_min_special();
+	}
+
+	// Adds to C the crumbs of U on all trie nodes above their reference nodes, at most once per trie node, seed and match.
+	// Trie nodes are processed bottom-up (children have larger ids than their parents) so each is visited once.
+    void put_crumbs_up_the_trie() {
+		std::unordered_map<node_t, std::vector<crumb_t>> trie_crumbs;  // Crumbs collected from the children of a trie node.
+		std::priority_queue<node_t> Q;                                 // Trie nodes with collected crumbs, deepest first.
+
+		auto pass_to_parents = [&](node_t v, std::vector<crumb_t>::const_iterator from, std::vector<crumb_t>::const_iterator to) {
 			for (auto it=G.begin_orig_rev_edges(v); it!=G.end_orig_rev_edges(); ++it)
 				if (G.node_in_trie(it->to)) {
-					add_crumb_to_node(s, match_v, it->to);
-					update_crumbs_up_the_trie(s, match_v, it->to);
+					std::vector<crumb_t> &parent_crumbs = trie_crumbs[it->to];
+					if (parent_crumbs.empty())
+						Q.push(it->to);
+					for (auto c=from; c!=to; ++c)
+						parent_crumbs.push_back(crumb_t(it->to, c->s, c->m));
 				}
-    }
+		};
 
-    inline void add_crumb_to_node(const seed_t s, const node_t match_v, const node_t curr_v) {
-		C.push_back(crumb_t(curr_v,s)); 
+		std::sort(U.begin(), U.end());
+		U.erase(std::unique(U.begin(), U.end()), U.end());
+		for (auto from=U.begin(), to=U.begin(); from!=U.end(); from=to) {
+			for (to=from; to!=U.end() && to->v == from->v; ++to);
+			pass_to_parents(from->v, from, to);
+		}
+		U.clear();
+
+		while (!Q.empty()) {
+			node_t v = Q.top(); Q.pop();
+			std::vector<crumb_t> &crumbs = trie_crumbs[v];
+			std::sort(crumbs.begin(), crumbs.end());
+			crumbs.erase(std::unique(crumbs.begin(), crumbs.end()), crumbs.end());
+			C.insert(C.end(), crumbs.begin(), crumbs.end());
+			if (v != 0)
+				pass_to_parents(v, crumbs.begin(), crumbs.end());
+			trie_crumbs.erase(v);
+		}
     }
 
+	// Marks the reference nodes near an N (see near_unknown_) and finds the distances of the trie nodes
+	// above them by BFS on the backward edges.
+	void mark_near_unknown(int max_dist) {
+		near_unknown_.assign(G.trie_first_node, false);
+		unknown_trie_dist_.clear();
+		near_unknown_dist_ = max_dist;
+		std::vector<node_t> curr, next;
+		for (node_t u=1; u<G.trie_first_node; u++)
+			for (auto it=G.begin_orig_edges(u); it!=G.end_orig_edges(); ++it)
+				if (graph_t::trie_exit(it->label)) {
+					near_unknown_[u] = true;
+					curr.push_back(u);
+					break;
+				}
+
+		for (int d=0; !curr.empty() && d < max_dist; d++) {
+			next.clear();
+			for (node_t v: curr)
+				for (auto it=G.begin_orig_rev_edges(v); it!=G.end_orig_rev_edges(); ++it) {
+					node_t u = it->to;
+					if (G.node_in_trie(u)) {
+						if (unknown_trie_dist_.emplace(u, d+1).second)
+							next.push_back(u);
+					} else if (!near_unknown_[u]) {
+						near_unknown_[u] = true;
+						next.push_back(u);
+					}
+				}
+			curr.swap(next);
+		}
+	}
+
   public:
     AStarSeedsWithErrors(const graph_t &_G, const EditCosts &_costs, const Args &_args)
-        : G(_G), costs(_costs), args(_args) {
-		if (args.seed_len == -1)
-			throw "seed len not set.";
+        : G(_G), costs(_costs), args(_args), crumbs_cache_(_args.crumb_cache_size), has_unknown_(false), near_unknown_dist_(-1) {
+		if (args.seed_len != -1 && args.seed_len < G.get_trie_depth())
+			throw "seed len should not be shorter than the trie depth.";
+		for (const edge_t &e: G.E)
+			if (e.type == ORIG && graph_t::trie_exit(e.label))
+				has_unknown_ = true;
     }
 
     // Cut r into chunks of length seed_len, starting from the end.
     void before_every_alignment(const read_t *r) {
+		AllocScope scope(ALLOC_CRUMBS);
 		assert(C.empty());
         r_ = r;
 
         read_cnt.clear();
         read_cnt.reads.set(1);
 
-		std::vector<pos_t> seed_starts = generate_seeds(r, 1.0);
-		seeds_ = seed_starts.size(); 
+		std::vector<seed_occ_t> seeds = generate_seeds(r);
+		seeds_ = seeds.size(); 
 		max_indels_ = std::ceil((r->len * costs.match + seeds_ * costs.get_delta_min_special()) / costs.del);
 		LOG_DEBUG << "max_indels: " << max_indels_;
 
-		match_all_seeds(seed_starts, r);
+		// An N under the last letter of a missed seed match is at most the read length and max_indels_
+		// letters further.
+		int unknown_dist = r->len + max_indels_;
+		if (has_unknown_ && unknown_dist > near_unknown_dist_)
+			mark_near_unknown(std::max(unknown_dist, 2*near_unknown_dist_));
+
+		seeds_after_.assign(r->len+1, 0);
+		seed_start_.assign(r->len+1, false);
+		for (const auto &seed: seeds)
+			seed_start_[seed.start] = true;
+		for (int i=r->len-1; i>=0; i--)
+			seeds_after_[i] = seeds_after_[i+1] + seed_start_[i+1];
+		seed_end_.clear();
+		for (const auto &seed: seeds)
+			seed_end_.push_back(seed.start + seed.len - 1);
+
+		match_all_seeds(seeds);
+		put_crumbs_up_the_trie();
 		std::sort(C.begin(), C.end());
+		std::sort(R.begin(), R.end());
+		max_range_len_ = 0;
+		size_t crumbed_range_nodes = 0;
+		for (const auto &range: R) {
+			max_range_len_ = std::max(max_range_len_, range.to - range.from + 1);
+			crumbed_range_nodes += range.to - range.from + 1;
+		}
+
+		pruned.assign(M.size(), INF);
+		M_order.resize(M.size());
+		for (int m=0; m<(int)M.size(); m++)
+			M_order[m] = m;
+		std::sort(M_order.begin(), M_order.end(), [this](int a, int b) { return M[a] < M[b]; });
 
-		read_cnt.states_with_crumbs.set(C.size());
+		read_cnt.states_with_crumbs.set(C.size() + crumbed_range_nodes);
+		read_cnt.crumb_ranges.set(R.size());
         read_cnt.seeds.set(seeds_);
         read_cnt.root_heuristic.set( h(state_t(0.0, 0, 0, -1, -1)) );
         read_cnt.heuristic_potential.set(seeds_);
@@ -128,45 +379,124 @@ class AStarSeedsWithErrors: public AStarHeuristic {
         global_cnt += read_cnt;
     }
 
-    // Split r into seeds of length seed_len. Return a vector of starting points of the seeds from last to first;
-	std::vector<pos_t> generate_seeds(const read_t *r, double seeds_retain_frac) {
-		int max_seeds = (r->len + args.seed_len - 1) / args.seed_len;  // ceil of r->len/seed_len
-		std::vector<pos_t> seed_starts;
-        for (int i=r->len-args.seed_len; i>=0; i-=args.seed_len) {
-			seed_starts.push_back(i);
-			if ((int)seed_starts.size() == int(seeds_retain_frac * max_seeds))
-				break;
+	// Mean error probability of the read letters according to their phred values.
+	static double estimated_error_rate(const read_t *r) {
+		if (r->phreds.empty())
+			return kDefaultErrorRate;
+		double sump = 0.0;
+		for (size_t i=1; i<r->phreds.size(); i++)
+			sump += pow(10.0, -(int(r->phreds[i])-33)/10.0);
+		return sump / r->len;
+	}
+
+	// Seeds should be more than twice as many as the expected errors but not so short
+	// that they match by chance in a graph of this size.
+	int seed_len_for_read(const read_t *r) const {
+		if (args.seed_len != -1)
+			return args.seed_len;
+		int min_len = std::max(G.get_trie_depth(), (int)std::ceil(log(4.0, G.orig_nodes)) + 1);
+		double errors = r->len * estimated_error_rate(r);
+		return std::max(min_len, int(r->len / (2.0*errors + 4.0)));
+	}
+
+    // Split r into seeds, starting from the end. Return the seeds from last to first.
+	// A seed with more than max_seed_matches matches is lengthened up to twice and dropped if still too repetitive.
+	std::vector<seed_occ_t> generate_seeds(const read_t *r) {
+		int len = seed_len_for_read(r);
+		std::vector<seed_occ_t> seeds;
+		for (int end=r->len; end-len >= 0; ) {
+			seed_occ_t seed;
+			bool repetitive = true;
+			for (seed.len = len; seed.len <= 2*len && end-seed.len >= 0; seed.len += std::max(1, len/2)) {
+				seed.start = end - seed.len;
+				seed.ends.clear();
+				if (find_reverse_complement_matches(r, seed.start, seed.start+seed.len-1, G.trie_root(), &seed.ends)) {
+					repetitive = false;
+					break;
+				}
+			}
+
+			if (repetitive) {
+				++read_cnt.dropped_seeds;
+				end -= len;
+			} else {
+				if (seed.len > len)
+					++read_cnt.lengthened_seeds;
+				end = seed.start;
+				seeds.push_back(seed);
+			}
 		}
-		return seed_starts;
+		return seeds;
 	}
 	
     // For each exact occurence of a seed (i,v) in the graph,
     //   add 1 to C[u] for all nodes u on the path of match-length exactly `i` from supersource `0` to `v`
-    void match_all_seeds(const std::vector<pos_t> &seed_starts, const read_t *r) {
-		for (int s=0; s<(int)seed_starts.size(); s++) {
-			pos_t start_pos = seed_starts[s];
-            match_reverse_complement_seed(r, s, start_pos, start_pos+args.seed_len-1, G.trie_root());  // seed from [st, st+seed_len)
-		}
+    void match_all_seeds(const std::vector<seed_occ_t> &seeds) {
+		for (int s=0; s<(int)seeds.size(); s++)
+			for (node_t v: seeds[s].ends) {
+				node_t u = G.node2revcompl(v);
+				M.push_back(match_t(seeds[s].start, u));
+				add_crumbs(s, u, seeds[s].start-1);
+				++read_cnt.seed_matches;
+			}
     }
+
+	// Crumbs the nodes from which the match starting at match_v can be reached, reusing the nodes found for previous reads.
+	void add_crumbs(const seed_t s, const node_t match_v, int i) {
+		int m = (int)M.size()-1;
+		crumbs_key_t key{match_v, pos_t(i), max_indels_};
+		const match_crumbs_t *cached = crumbs_cache_.get(key);
+		match_crumbs_t crumbs;
+		if (cached)
+			++read_cnt.crumb_cache_hits;
+		else
+			put_crumbs_backwards(match_v, i, &crumbs);
+
+		const match_crumbs_t &nodes = cached ? *cached : crumbs;
+		for (const node_range_t &range: nodes.ranges)
+			R.push_back(crumb_range_t(range, s, m));
+		for (node_t v: nodes.up)
+			U.push_back(crumb_t(v, s, m));
+
+		if (!cached)
+			crumbs_cache_.put(key, std::move(crumbs));
+	}
 	
+    // Collects the ends of the exact matches of the reverse complement of r[start, i] from v.
+	// Returns false as soon as there are more than max_seed_matches of them.
     // Assumes that seed_len >= D so the match is outside of the trie.
-    void match_reverse_complement_seed(const read_t *r, const seed_t s, const int start, const int i, const node_t v) {
+    bool find_reverse_complement_matches(const read_t *r, const int start, const int i, const node_t v, std::vector<node_t> *ends) {
         if (i >= start) {
             // Match exactly down the trie and then through the original graph.
 			label_t c = compl_nucl(r->s[i]);
-            for (auto it=G.begin_all_matching_edges(v, c); it!=G.end_all_edges(); ++it)
-                if (it->type == ORIG || it->type == JUMP)  // ORIG in the graph, JUMP in the trie
-                    match_reverse_complement_seed(r, s, start, i-1, it->to);
+            graph_t::out_edges_t out(&G, v);
+            auto match = out.matching(c);
+            for (const edge_t *e=match.first; e!=match.second; ++e)  // ORIG in the graph, JUMP in the trie
+                if (!out.filtered() || label_matches(e->label, c))
+                    if (!find_reverse_complement_matches(r, start, i-1, e->to, ends))
+                        return false;
         } else {
 			// All the seed is aligned now.
-			node_t u = G.node2revcompl(v);
-			put_crumbs_backwards(s, u, i);
-            ++read_cnt.seed_matches;
+			ends->push_back(v);
+			if (args.max_seed_matches && (int)ends->size() > args.max_seed_matches)
+				return false;
         }
+		return true;
     }
 
+	// The deepest trie level from which an edge enters v, or -1 if none. With a variable trie depth,
+	// the leaves sit at different depths, so the trie reaches some nodes after fewer letters.
+	int trie_depth_into(node_t v) const {
+		int depth = -1;
+		for (auto it=G.begin_orig_rev_edges(v); it!=G.end_orig_rev_edges(); ++it)
+			if (G.node_in_trie(it->to))
+				depth = std::max(depth, G.trie_node_depth(it->to) + 1);
+		return depth;
+	}
+
 	// TopSort from match_v on backwards edges with max distance i+max_indels_.
-    void put_crumbs_backwards(const seed_t s, const node_t match_v, int i) {
+    void put_crumbs_backwards(const node_t match_v, int i, match_crumbs_t *crumbs) const {
+		std::vector<node_t> nodes;                                      // All crumbed nodes, encoded as ranges in the end.
 		std::unordered_map<node_t, int> min_pos;                        // _minimal_ read index where an _expanded_ node can be aligned without indels so that r[i] aligns at match_v
 		std::unordered_map<node_t, int> max_pos;                        // _maximal_ read index where an _explored_ node --||--
 		std::unordered_map<node_t, int> outgoing;                       // Number of explored outgoing edges of a node
@@ -182,9 +512,12 @@ class AStarSeedsWithErrors: public AStarHeuristic {
 			node_t v = Q.front(); Q.pop();
 																		assert(min_pos.contains(v));
 																		assert(max_pos.contains(v));
-			add_crumb_to_node(s, match_v, v);
-			if (!args.skip_near_crumbs || min_pos[v] <= G.get_trie_depth() + max_indels_)
-				update_crumbs_up_the_trie(s, match_v, v);
+			nodes.push_back(v);
+			bool near = !args.skip_near_crumbs || min_pos[v] <= max_indels_;
+			if (!near && min_pos[v] <= G.get_trie_depth() + max_indels_)
+				near = G.fixed_trie_depth || min_pos[v] <= trie_depth_into(v) + max_indels_;
+			if (near)
+				crumbs->up.push_back(v);
 			for (auto it=G.begin_orig_rev_edges(v); it!=G.end_orig_rev_edges(); ++it) {
 				node_t u = it->to;
 				if (!G.node_in_trie(u)) {
@@ -228,7 +561,7 @@ class AStarSeedsWithErrors: public AStarHeuristic {
 		// BFS on both reference graph and trie: add a crumb to all nodes before position -max_indels_.
 		while (!Q.empty()) {
 			node_t v = Q.front(); Q.pop();
-			add_crumb_to_node(s, match_v, v);
+			nodes.push_back(v);
 			for (auto it=G.begin_orig_rev_edges(v); it!=G.end_orig_rev_edges(); ++it) {
 				node_t u = it->to;
 				if (!max_pos.contains(u))
@@ -238,39 +571,76 @@ class AStarSeedsWithErrors: public AStarHeuristic {
 					}
 			}
 		}
+
+		std::sort(nodes.begin(), nodes.end());
+		nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+		for (size_t j=0; j<nodes.size(); j++) {
+			if (j == 0 || nodes[j] != nodes[j-1]+1)
+				crumbs->ranges.push_back(node_range_t(nodes[j], nodes[j]));
+			else
+				crumbs->ranges.back().to = nodes[j];
+		}
 	}
 
 	// Seed heuristic query called during A* alignment.
 	cost_t h(const state_t &st) const {
-		int seeds_to_end = std::min((r_->len - st.i - 1) / args.seed_len, seeds_);
-		int missing = seeds_to_end;  // Maximum number of errors.
+		auto c_from = C.cbegin();
+		auto r_from = R.cbegin();
+		return h(st, has_crumb_, c_from, r_from);
+	}
 
-		const auto from = std::lower_bound(C.begin(), C.end(), crumb_t(st.v, 0));
-		const auto to = std::lower_bound(C.begin(), C.end(), crumb_t(st.v+1, 0));
+	// The successors of an expanded state are at one or two read positions and mostly on ascending nodes
+	// (the reference, trie siblings), so they share the seeds after a position, the buffer of found seeds
+	// and the searches in C and R, which continue from those of the previous state.
+	void h_batch(const state_t *st, size_t n, cost_t *hs) const {
+		auto c_from = C.cbegin();
+		auto r_from = R.cbegin();
+		for (size_t k=0; k<n; k++) {
+			if (k > 0 && st[k].v < st[k-1].v) {
+				c_from = C.cbegin();
+				r_from = R.cbegin();
+			}
+			hs[k] = h(st[k], has_crumb_, c_from, r_from);
+		}
+	}
 
-		std::vector<int> cnt(seeds_to_end);
-		int m = missing;  // m is the current number of different seeds inside of [it1, it2]
+	bool is_dynamic() const {
+		return args.match_pruning;
+	}
 
-		for (auto it1=from, it2=from; it1 != to && it2 != to; ++it1) {  // left iterator
-			for (; it2 != to; ++it2)
-				if (it2->s < seeds_to_end)
-					if (cnt[it2->s]++ == 0)
-						missing = std::min(missing, --m);
-			if (it1->s < seeds_to_end)
-				if (--cnt[it1->s] == 0)
-					++m;
-		}
-   
-		return (r_->len - st.i)*costs.match + missing*costs.get_delta_min_special();
+	// Match pruning: once the start of a seed match is expanded with cost g, any path through the match
+	// from a state with cost >= g is dominated by the expanded one, so the crumbs of the match are ignored
+	// for such states. Unlike unconditional pruning, this keeps h admissible where it matters even though
+	// the seed heuristic is not consistent (the search reopens states to compensate).
+	void on_expand(const state_t &st) {
+		if (!args.match_pruning || !seed_start_[st.i])
+			return;
+		auto cmp = [this](int m, const match_t &key) { return M[m] < key; };
+		for (auto it = std::lower_bound(M_order.begin(), M_order.end(), match_t(st.i, st.v), cmp);
+				it != M_order.end() && M[*it].start == st.i && M[*it].v == st.v; ++it)
+			if (st.cost < pruned[*it]) {
+				if (pruned[*it] == INF)
+					++read_cnt.pruned_matches;
+				pruned[*it] = st.cost;
+			}
 	}
 
     void after_every_alignment(const AlignerTimers &t) {
         C.clear();  // Clean up all crumbs before next alignment.
+        R.clear();
+        M.clear();
+        global_cnt.pruned_matches += read_cnt.pruned_matches;
     }
 
     void print_params(std::ostream &out) const {
-        out << "          seed length: " << args.seed_len << " bp"         << std::endl;
+        if (args.seed_len == -1)
+            out << "          seed length: auto (per read)"                << std::endl;
+        else
+            out << "          seed length: " << args.seed_len << " bp"     << std::endl;
+        out << " max matches per seed: " << (args.max_seed_matches ? std::to_string(args.max_seed_matches) : "unlimited") << std::endl;
         out << "     skip near crumbs: " << args.skip_near_crumbs          << std::endl;
+        out << "        match pruning: " << args.match_pruning             << std::endl;
+        out << "     crumb cache size: " << args.crumb_cache_size << " ranges" << std::endl;
     }
 
     void print_stats(std::ostream &out) const {
@@ -279,8 +649,12 @@ class AStarSeedsWithErrors: public AStarHeuristic {
         out << "        For all reads:"                                                     << std::endl;
         out << "                            Seeds: " << global_cnt.seeds << " (" << 1.0*global_cnt.seeds.get()/reads << " per read)"                  << std::endl;
         out << "                     Seed matches: " << global_cnt.seed_matches << " (" << 1.0*global_cnt.seed_matches.get()/reads << " per read, " << 1.0*global_cnt.seed_matches.get()/global_cnt.seeds.get() << " per seed)" << std::endl;
+        out << "                   Repeated seeds: " << global_cnt.lengthened_seeds << " lengthened, " << global_cnt.dropped_seeds << " dropped" << std::endl;
+        out << "                 Crumb cache hits: " << global_cnt.crumb_cache_hits << " (" << 100.0*global_cnt.crumb_cache_hits.get()/global_cnt.seed_matches.get() << "% of matches), " << crumbs_cache_.size() << " ranges cached" << std::endl;
         out << "               States with crumbs: " << global_cnt.states_with_crumbs
             << " [+" << 100.0*global_cnt.repeated_states.get()/(global_cnt.states_with_crumbs.get()+global_cnt.repeated_states.get()) << "% repeated], (" << 1.0*global_cnt.states_with_crumbs.get()/reads << " per read)" << std::endl;
+        out << "                     Crumb ranges: " << global_cnt.crumb_ranges << " (" << 1.0*global_cnt.crumb_ranges.get()/reads << " per read)" << std::endl;
+        out << "                   Pruned matches: " << global_cnt.pruned_matches << " (" << 100.0*global_cnt.pruned_matches.get()/global_cnt.seed_matches.get() << "% of matches)" << std::endl;
         out << "                  Heuristic (avg): " << 1.0*global_cnt.root_heuristic.get()/reads << " of potential " << 1.0*global_cnt.heuristic_potential.get()/reads << std::endl;
     }
 
@@ -288,6 +662,7 @@ class AStarSeedsWithErrors: public AStarHeuristic {
         LOG_INFO << r_->comment << " A* seeds stats: "
             << read_cnt.seeds.get() << " seeds " 
             << "matching at " << read_cnt.seed_matches << " graph positions "
+            << "(" << read_cnt.lengthened_seeds << " lengthened, " << read_cnt.dropped_seeds << " dropped) "
             << "over " << read_cnt.states_with_crumbs << " states"
             << "(" << read_cnt.repeated_states << " repeated)"
             << "with best heuristic " << read_cnt.root_heuristic.get() << " "
@@ -297,6 +672,18 @@ class AStarSeedsWithErrors: public AStarHeuristic {
 	int crumbs() const {
 		return global_cnt.states_with_crumbs.get();
 	}
+
+	// The seed matches of the current read and their crumbs put anew (without the cache), for replaying
+	// the crumbing on its own (see microbench.cpp). Returns the number of crumbed ranges and trie nodes.
+	int matches() const {
+		return M.size();
+	}
+
+	size_t put_match_crumbs(int m) const {
+		match_crumbs_t crumbs;
+		put_crumbs_backwards(M[m].v, M[m].start-1, &crumbs);
+		return crumbs.ranges.size() + crumbs.up.size();
+	}
 };
 
 }
@@ -1,6 +1,7 @@
 //#define NDEBUG
 
 #include <algorithm>
+#include <iomanip>
 #include <dirent.h>
 #include <errno.h>
 #include <stdexcept>
@@ -19,12 +20,16 @@
 #include "argparse.h"
 #include "concurrentqueue.h"
 #include "graph.h"
+#include "heuristic-factory.h"
 #include "io.h"
 #include "trie.h"
 #include "kseq.h"
+#include "microbench.h"
 
 // A* heuristics
 #include "dijkstra.h"
+#include "histogram.h"
+#include "perf-counters.h"
 #include "astar-prefix.h"
 #include "astar-seeds.h"
 
@@ -50,39 +55,32 @@ void init_logger(const char *log_fn, int verbose) {
     }
 }
 
-unique_ptr<AStarHeuristic> AStarHeuristicFactory(const graph_t &G, const arguments &args) {
-    unique_ptr<AStarHeuristic> astar;
-    string algo = args.algorithm;
-
-    if (algo == "astar-prefix") {
-        astar = make_unique<AStarPrefix>(G, args.costs, args.AStarLengthCap, args.AStarCostCap, args.AStarNodeEqivClasses);
-    } else if (algo == "astar-seeds") {
-        if (!args.fixed_trie_depth)
-            throw invalid_argument("astar-seeds algorithm can only be used with fixed_trie_depth flag on.");
-
-        astar = make_unique<AStarSeedsWithErrors>(G, args.costs, args.astar_seeds);
-    } else if (algo == "dijkstra") { 
-        astar = make_unique<DijkstraDummy>();
-    } else {
-        cout << "No algorithm " << args.algorithm << endl;
-        throw invalid_argument("Unknown algorithm.");
-    }
-
-    return astar;
+// Creates the heuristic of the algorithm and specializes the search of the aligner for its type.
+unique_ptr<AStarHeuristic> AStarHeuristicFactory(const graph_t &G, const arguments &args, Aligner *aligner) {
+    return make_heuristic(G, args, [aligner](auto *astar) { aligner->set_heuristic(astar); });
 }
 
 arguments args;
 
-void wrap_readmap(const read_t& r, string algo, string performance_file, Aligner *aligner, bool calc_mapping_cost,
+void wrap_readmap(const read_t& r, const string &algo, const string &performance_file, Aligner *aligner, bool calc_mapping_cost,
         edge_path_t *best_path, double *pushed_rate_sum, double *popped_rate_sum, double *repeat_rate_sum, double *pushed_rate_max, double *popped_rate_max, double *repeat_rate_max, FILE *fout,
-       Stats *global_stats) {
+       Stats *global_stats, ReadHistograms *hists) {
     std::vector<state_t> final_states;
     
+    int crumbs_before = aligner->get_astar().crumbs();
+    uint64_t allocs_before = total_allocs();
+    auto start_wt = std::chrono::steady_clock::now();
     aligner->astar_before_every_alignment(&r);      // prepare read
-    final_states = aligner->readmap(r, algo, args.k_best_alignments);  // align
+    final_states = aligner->readmap(r, args.k_best_alignments);  // align
 	aligner->astar_after_every_alignment();         // return preparation to previous state
+    std::chrono::nanoseconds wt = std::chrono::steady_clock::now() - start_wt;
+    uint64_t allocs = total_allocs() - allocs_before;
 	*global_stats += aligner->stats;
 
+    AllocScope scope(ALLOC_OUTPUT);
+    hists->add(r.comment, wt.count(), aligner->stats.explored_states.get(), aligner->stats.popped.get(),
+        uint64_t(aligner->stats.t.astar.get_sec() * 1e9), aligner->get_astar().crumbs() - crumbs_before, allocs);
+
 	if ((int)final_states.size() >= args.k_best_alignments) {
 		LOG_DEBUG << r.s << " aligned >= " << args.k_best_alignments << " times.";
 	}
@@ -96,9 +94,9 @@ void wrap_readmap(const read_t& r, string algo, string performance_file, Aligner
 			int L = r.len;
 			char strand = '?';
 			
-			int start = best_path->back().to;   // meaningful only for fasta where the nodeid is equal to the fasta position
+			node_t start = best_path->back().to;   // meaningful only for fasta where the nodeid is equal to the fasta position
 			assert(start > 0);
-			assert(start <= 2*((int)aligner->graph().nodes()+5));
+			assert(start <= 2*(aligner->graph().nodes()+5));
 
 			assert (!aligner->graph().node_in_trie(start));
 			if (aligner->graph().node_in_reverse(start)) {
@@ -125,17 +123,17 @@ void wrap_readmap(const read_t& r, string algo, string performance_file, Aligner
 			char line[100000];
 			line[0] = 0;
 			sprintf(line,
-					"%8s\t%3d\t%8s\t"
+					"%8s\t%3lld\t%8s\t"
 					"%8s\t%15s\t%8lf\t"
 					"%3d\t%10s\t%10s\t"
-					"%d\t%6d\t%c\t%6lf\t"
+					"%d\t%6lld\t%c\t%6lf\t"
 					"%6lf\t%4lf\t%8lf\t"
 					"%8lf\t%d\t%d\t"
                     "%d\n",
-					args.graph_file.c_str(), (int)aligner->graph().nodes(), algo.c_str(),
+					args.graph_file.c_str(), (long long)aligner->graph().nodes(), algo.c_str(),
 					precomp_str.c_str(), r.comment.c_str(), 0.0,
 					L, r.s.c_str(), spell(*best_path).c_str(),
-					int(aligner->stats.align_status.cost.get()), start, strand, pushed_rate,
+					int(aligner->stats.align_status.cost.get()), (long long)start, strand, pushed_rate,
 					popped_rate, repeat_rate, aligner->stats.t.total.get_sec(),
 					aligner->stats.t.astar.get_sec(), aligner->stats.align_status.unique.get(), aligner->stats.explored_states.get(),
                     crumbs);
@@ -159,7 +157,8 @@ void read_queries(std::string query_file, vector<read_t> *R) {
 		std::string id = seq->name.s;
 		std::string readstr = seq->seq.s;
 		std::transform(readstr.begin(), readstr.end(), readstr.begin(), [](unsigned char c){ return std::toupper(c); });
-		r = read_t(readstr, "", id, "");
+		std::string phreds = seq->qual.l ? seq->qual.s : "";
+		r = read_t(readstr, phreds, id, "");
 		R->push_back(r);
 	}
 	kseq_destroy(seq);
@@ -188,12 +187,110 @@ double avg_error_rate(const vector<read_t> &R) {
     return sump/letters;
 }
 
+const char *trie_layout_name(trie_layout_t layout) {
+    switch (layout) {
+        case VARIABLE_TRIE: return "variable";
+        case FIXED_TRIE:    return "fixed";
+        case FM_TRIE:       return "FM-index";
+        case LAZY_TRIE:     return "lazy";
+    }
+    return "";
+}
+
+// Chooses the trie depth and layout and the crumb cache size which are not given on the command line,
+// so that the estimated memory fits args->memory_budget_gb. Prefers the deepest trie, and for each
+// depth the layouts in the order of their alignment speed. The prefix heuristic memoizes lazily
+// without a cap, so only its per-node tables are budgeted.
+void plan_memory(const graph_t &G, const vector<read_t> &R, arguments *args) {
+    const double GB = 1024.0 * 1024.0 * 1024.0;
+    const double CRUMB_RANGE_BYTES = 32.0;  // a cached node range with its share of the cache entry
+    const double CRUMB_CACHE_RANGES = 10000000;  // the largest crumb cache to grant
+    double budget = args->memory_budget_gb * GB;
+    // The reference (with the reverse edges) and the reads (letters and phred values) are already loaded.
+    double loaded = max(2.0 * G.total_mem_bytes() + 2.0 * size_sum(R), MemoryMeasurer::get_mem_gb() * GB);
+    double min_lazy_bytes = G.V.size() * sizeof(node_t);  // below, each expansion scans the whole reference
+    double node_tables = strcmp(args->algorithm, "astar-prefix") == 0 ? 3.0 * sizeof(node_t) : 0.0;
+    bool seeds = strcmp(args->algorithm, "astar-seeds") == 0;
+
+    bool layout_given = args->given.count(1001) || args->given.count(1002) || args->given.count(1003);
+    trie_layout_t given_layout = !args->fixed_trie_depth ? VARIABLE_TRIE
+                               : args->fm_index ? FM_TRIE
+                               : args->lazy_trie_gb > 0.0 ? LAZY_TRIE : FIXED_TRIE;
+    int max_depth = args->tree_depth;
+    int min_depth = args->given.count('D') ? max_depth : 1;
+    vector<double> walks = sample_reference_walks(G, max_depth);
+    bool linear = is_linear_reference(G);
+    LOG_INFO << "Memory plan: " << loaded / GB << "gb loaded, " << walks[max_depth] << " walks of length " << max_depth
+        << ", " << (linear ? "linear" : "non-linear") << " reference";
+
+    for (int depth=max_depth; depth>=min_depth; depth--) {
+        vector<trie_layout_t> layouts = { given_layout };
+        if (!layout_given) {
+            layouts = { VARIABLE_TRIE, FIXED_TRIE };
+            if (linear) layouts.push_back(FM_TRIE);
+            layouts.push_back(LAZY_TRIE);
+        }
+        for (trie_layout_t layout: layouts) {
+            if (depth == 1 && layout != VARIABLE_TRIE && layout != given_layout)
+                continue;  // all layouts are the same
+            trie_size_t trie = estimate_trie_size(G, walks, depth, layout);
+            if (layout != VARIABLE_TRIE && depth >= 2 && G.V.size() + trie.nodes > MAX_IDS)
+                continue;  // too many implicit node ids
+            if (layout == FM_TRIE && G.V.size() > INT_MAX)
+                continue;  // the FM-index keeps 32-bit nodes
+            double base = loaded + (G.V.size() + trie.nodes) * node_tables;
+            if (layout == LAZY_TRIE && depth >= 2) {
+                // Half of the rest for the frontiers, the other half for the crumbs.
+                double ceiling = layout_given ? args->lazy_trie_gb * GB : (budget - base) / (seeds ? 2.0 : 1.0);
+                ceiling = min(ceiling, estimate_trie_size(G, walks, depth, FIXED_TRIE).kept_bytes);
+                if (!layout_given && ceiling < min_lazy_bytes)
+                    continue;
+                trie.build_bytes = trie.kept_bytes = ceiling;
+            }
+            // The memory freed after building the trie is not necessarily returned to the system.
+            double need = base + trie.build_bytes;
+            if (need > budget) {
+                LOG_INFO << "Memory plan: a " << trie_layout_name(layout) << " trie of depth " << depth << " needs "
+                    << need / GB << "gb (" << trie.kept_bytes / GB << "gb kept)";
+                continue;
+            }
+
+            args->tree_depth = depth;
+            args->fixed_trie_depth = layout != VARIABLE_TRIE;
+            args->fm_index = layout == FM_TRIE;
+            if (layout == LAZY_TRIE)
+                args->lazy_trie_gb = trie.kept_bytes / GB;
+            // Half of the rest for the crumb cache, the other half for the queue, the states, the
+            // crumbs and the prefix memo of each read.
+            double rest = budget - need;
+            if (seeds && !args->given.count(2011))
+                args->astar_seeds.crumb_cache_size = (int)min(CRUMB_CACHE_RANGES, rest / 2.0 / CRUMB_RANGE_BYTES);
+            if (seeds)
+                need += args->astar_seeds.crumb_cache_size * CRUMB_RANGE_BYTES;
+
+            cout << "trie depth=" << depth << " (" << trie_layout_name(layout) << ")";
+            if (layout == LAZY_TRIE && depth >= 2)
+                cout << " with " << args->lazy_trie_gb << "gb of frontiers";
+            if (seeds)
+                cout << ", crumb cache of " << args->astar_seeds.crumb_cache_size << " ranges";
+            cout << "; estimated " << need / GB << "gb of " << args->memory_budget_gb << "gb... " << flush;
+            return;
+        }
+    }
+    throw "The memory budget is too small for the reference, the reads and the trie.";
+}
+
 void auto_params(const graph_t &G, const vector<read_t> &R, arguments *args) {
     if (args->tree_depth == -1) {
         args->tree_depth = floor(log(G.nodes()) / log(4.0));
     }
     if (args->tree_depth <= 0)
         throw "Trie depth should be >0.";
+    if (args->memory_budget_gb > 0.0) {
+        cout << "Planning memory... " << flush;
+        plan_memory(G, R, args);
+        cout << "done." << endl << flush;
+    }
 }
 
 void print_tsv(map<string, string> dict, ostream &out) {
@@ -211,15 +308,18 @@ typedef map<string, string> dict_t;
 
 struct Measurers {
     struct TimeAndMemory {
-        Timer t;
+        PhaseTimer t;
         MemoryMeasurer m;
+        PerfMeasurer p;
 
         void start() {
             t.start();
             m.start();
+            p.start();
         }
 
         void stop() {
+            p.stop();
             t.stop();
             m.stop();
         }
@@ -241,6 +341,23 @@ struct Measurers {
         (*dict)["precompute_sec"] = to_string(precompute.t.get_sec());
         (*dict)["precompute_gb"] = to_string(precompute.m.get_gb());
     }
+
+    void set_perf_counters(const PerfCounters *pc) {
+        for (TimeAndMemory *tm: { &total, &construct_trie, &read_graph, &read_queries, &align, &precompute })
+            tm->p.set_counters(pc);
+    }
+
+    void extract_perf_to_dict(const AlignerPerf &perf, dict_t *dict) {
+        total.p.extract_to_dict("total", dict);
+        construct_trie.p.extract_to_dict("construct_trie", dict);
+        read_graph.p.extract_to_dict("read_graph", dict);
+        read_queries.p.extract_to_dict("read_queries", dict);
+        precompute.p.extract_to_dict("precompute", dict);
+        align.p.extract_to_dict("align", dict);
+        perf.astar.extract_to_dict("align_astar", dict);
+        perf.expand.extract_to_dict("align_expand", dict);
+        perf.queue.extract_to_dict("align_queue", dict);
+    }
 };
 
 void extract_args_to_dict(const arguments &args, dict_t *dict) {
@@ -263,9 +380,15 @@ void extract_args_to_dict(const arguments &args, dict_t *dict) {
     (*dict)["AStarLengthCap"] = to_string(args.AStarLengthCap);
     (*dict)["AStarCostCap"] = to_string(args.AStarCostCap);
     (*dict)["AStarNodeEqivClasses"] = to_string(args.AStarNodeEqivClasses);
+    (*dict)["seeds_crumb_cache"] = to_string(args.astar_seeds.crumb_cache_size);
 
     // perf
     (*dict)["threads"] = to_string(args.threads);
+    (*dict)["huge_pages"] = to_string(args.huge_pages);
+    (*dict)["numa_node"] = to_string(args.numa_node);
+    (*dict)["perf_counters"] = to_string(args.perf_counters);
+    (*dict)["mapped_graph_gb"] = to_string(b2gb(mapped_page_bytes()));
+    (*dict)["anon_huge_pages_gb"] = to_string(b2gb(anon_huge_page_bytes()));
 }
 
 int exec_astarix(int argc, char **argv) {
@@ -297,6 +420,23 @@ int exec_astarix(int argc, char **argv) {
     Measurers T;
     dict_t stats;   // string key -> string value
 
+    // The phases are counted over all threads (e.g. building the trie) and the alignment parts over
+    // the aligning thread, which would take a system call per measured state without rdpmc.
+    unique_ptr<PerfCounters> perf_counters, align_perf_counters;
+    if (args.perf_counters) {
+        perf_counters = make_unique<PerfCounters>(true);
+        for (int e=0; e<PERF_EVENTS; e++)
+            if (!perf_counters->available(e))
+                cout << "Performance counter " << perf_event_names[e] << " is unavailable (NA in stats.log)." << endl;
+        T.set_perf_counters(perf_counters.get());
+        align_perf_counters = make_unique<PerfCounters>(false);
+        if (!align_perf_counters->rdpmc()) {
+            cout << "Performance counters cannot be read by rdpmc: the alignment is not split into heuristic, "
+                    "expansion and queue (NA in stats.log)." << endl;
+            align_perf_counters.reset();
+        }
+    }
+
     T.total.start();
     auto start_wt = std::chrono::high_resolution_clock::now();
 
@@ -318,21 +458,35 @@ int exec_astarix(int argc, char **argv) {
         fclose(fout);
     }
 
+    set_page_placement(args.huge_pages, args.numa_node);
+    if (args.numa_node != -1 && !pin_to_numa_node(args.numa_node))
+        throw "Cannot pin the aligner to the NUMA node.";
+
     graph_t G;
     vector<read_t> R;
     //clock_t start;
 
     cout << "Loading reference graph... " << flush;
     T.read_graph.start();
-    read_graph(&G, args.graph_file, output_dir);
-	G.add_reverse_complement();
-    cout << "Added reverse complement... " << flush;
+    {
+        AllocScope scope(ALLOC_GRAPH);
+        read_graph(&G, args.graph_file, output_dir);
+        G.add_reverse_complement();
+        cout << "Added reverse complement... " << flush;
+        if (args.reorder_nodes) {
+            G.reorder_nodes_bfs();
+            cout << "Reordered nodes... " << flush;
+        }
+    }
     T.read_graph.stop();
     cout << "done in " << T.read_graph.t.get_sec() << "s."  << endl << flush;
 
     cout << "Loading queries... " << flush;
     T.read_queries.start();
-    read_queries(args.query_file, &R);
+    {
+        AllocScope scope(ALLOC_READS);
+        read_queries(args.query_file, &R);
+    }
     T.read_queries.stop();
     cout << "done in " << T.read_queries.t.get_sec() << "s." << endl << flush;
 
@@ -340,19 +494,31 @@ int exec_astarix(int argc, char **argv) {
 
     cout << "Contructing trie... " << flush;
     T.construct_trie.start();
-    add_tree(&G, args.tree_depth, args.fixed_trie_depth);
+    {
+        AllocScope scope(ALLOC_TRIE);
+        add_tree(&G, args.tree_depth, args.fixed_trie_depth, args.fm_index, args.lazy_trie_gb);
+        G.group_edges_by_label();
+    }
     T.construct_trie.stop();
     cout << "done in " << T.construct_trie.t.get_sec() << "s." << endl << flush;
 
+    if (strcmp(args.command, "microbench") == 0) {
+        run_microbenchmarks(G, R, args, cout);
+        return 0;
+    }
+
+    AlignParams align_params(args.costs, args.greedy_match, args.maxAlignmentCost,
+            args.prefix_cache_size, args.prefix_cache_len == -1 ? args.tree_depth : args.prefix_cache_len);
+    string algo = string(args.algorithm);
+    Aligner aligner(G, align_params);
+    aligner.perf.set_counters(align_perf_counters.get());
+
     cout << "Initializing A* heuristic... " << flush;
     T.precompute.start();
-    unique_ptr<AStarHeuristic> astar = AStarHeuristicFactory(G, args);
+    unique_ptr<AStarHeuristic> astar = AStarHeuristicFactory(G, args, &aligner);
     T.precompute.stop();
     cout << "done in " << T.precompute.t.get_sec() << "s." << endl << flush;
 
-    AlignParams align_params(args.costs, args.greedy_match, args.maxAlignmentCost);
-    string algo = string(args.algorithm);
-
     assert(G.has_supersource());
     LOG_INFO << "Mapping init with graph with n=" << G.V.size() << " and m=" << G.E.size();
     align_params.print();
@@ -368,6 +534,9 @@ int exec_astarix(int argc, char **argv) {
                                     << int(args.costs.ins) << ", " << int(args.costs.del) << " (match, subst, ins, del)" << endl;
         out << "              Greedy match?: " << bool2str(args.greedy_match)                           << endl;
         out << "                    Threads: " << args.threads                                          << endl;
+        if (align_params.prefix_cache_size > 0)
+            out << "               Prefix cache: " << align_params.prefix_cache_size << " states, "
+                                                << align_params.prefix_len << "bp prefixes"                 << endl;
         out << endl;
         out << " == A* parameters =="                                                               << endl;
         astar->print_params(out);
@@ -376,12 +545,15 @@ int exec_astarix(int argc, char **argv) {
         // Note: the trie is built on top of the **doubled** original graph (incl. reverse).
         out << "         Original reference: " << G.orig_nodes << " nodes, " << G.orig_edges << " edges"<< endl;
         out << "                       Trie: " << G.trie_nodes << " nodes, " << G.trie_edges << " edges, "
-                                                << "depth" << (args.fixed_trie_depth ? "=" : "<=") << args.tree_depth                         << endl;
+                                                << "depth" << (args.fixed_trie_depth ? "=" : "<=") << args.tree_depth
+                                                << (G.fm_trie ? " (FM-index)" : G.lazy_trie ? " (lazy)" : "")                        << endl;
         out << "  Reference+ReverseRef+Trie: " << G.nodes() << " nodes, " << G.edges() << " edges, "
                                                 << "density: " << (G.edges() / 2) / (G.nodes() / 2 * G.nodes() / 2) << endl;
         out << "                      Reads: " << R.size() << " x " << size_sum(R)/R.size() << "bp, "
                 "coverage: " << 1.0 * size_sum(R) / ((G.edges() - G.trie_edges) / 2)<< "x" << endl;  // The graph also includes reverse edges.
         out << "            Avg phred value: " << 100.0*avg_error_rate(R) << "%" << endl;
+        out << "               Avg edge gap: " << G.avg_edge_gap() << " node ids"
+                                                << (args.reorder_nodes ? " (reordered)" : "")              << endl;
         out << endl;
 
         stats["orig_graph_nodes"] = to_string(G.orig_nodes);
@@ -390,6 +562,7 @@ int exec_astarix(int argc, char **argv) {
         stats["trie_edges"] = to_string(G.trie_edges);
         stats["total_nodes"] = to_string(G.nodes()); 
         stats["total_edges"] = to_string(G.edges());
+        stats["avg_edge_gap"] = to_string(G.avg_edge_gap());
     }
 
     double pushed_rate_sum(0.0), pushed_rate_max(0.0);
@@ -402,6 +575,7 @@ int exec_astarix(int argc, char **argv) {
     std::mutex timer_m;
     atomic_int popped_trie_total(0), popped_ref_total(0);
     Stats global_stats;
+    ReadHistograms hists;
 
     started_aligning = true;  // Used for interruptions.
 
@@ -409,13 +583,12 @@ int exec_astarix(int argc, char **argv) {
     bool calc_mapping_cost = false;
     if (args.threads == 1) {
         FILE *fout = fopen(performance_file.c_str(), "a");
-        Aligner aligner(G, align_params, astar.get());
         for (size_t i=0; i<R.size(); i++) {
             if (interrupted)
                 break;
 
             wrap_readmap(R[i], algo, performance_file, &aligner, calc_mapping_cost,
-                    &R[i].edge_path, &pushed_rate_sum, &popped_rate_sum, &repeat_rate_sum, &pushed_rate_max, &popped_rate_max, &repeat_rate_max, fout, &global_stats);
+                    &R[i].edge_path, &pushed_rate_sum, &popped_rate_sum, &repeat_rate_sum, &pushed_rate_max, &popped_rate_max, &repeat_rate_max, fout, &global_stats, &hists);
 
             popped_trie_total.fetch_add( aligner.stats.popped_trie.get() );  
             popped_ref_total.fetch_add( aligner.stats.popped_ref.get() );
@@ -434,8 +607,8 @@ int exec_astarix(int argc, char **argv) {
 //            threads[t] = thread([&, t]() {
 //                int from = t*bucket_sz;
 //                int to = (t < args.threads-1) ? (t+1)*bucket_sz : R.size();
-//                unique_ptr<AStarHeuristic> astar_local = AStarHeuristicFactory(G, args);
-//                Aligner aligner(G, align_params, astar_local.get());
+//                Aligner aligner(G, align_params);
+//                unique_ptr<AStarHeuristic> astar_local = AStarHeuristicFactory(G, args, &aligner);
 //                LOG_INFO << "thread " << t << " for reads [" << from << ", " << to << ")";
 //                for (int i=from; i<to; i++) {
 //                    wrap_readmap(R[i], algo, performance_file, &aligner, calc_mapping_cost,
@@ -484,13 +657,19 @@ int exec_astarix(int argc, char **argv) {
 		out << "         States with crumbs: " << 100.0*astar->crumbs() / size_sum(R) / G.orig_nodes << "%" << endl;
 		out << "            Explored states: " << 100.0*global_stats.explored_states.get() / size_sum(R) / G.orig_nodes << "%" << endl;
 		out << "             Skipped states: " << 100.0 - 100.0*(astar->crumbs() + global_stats.explored_states.get()) / size_sum(R) / G.orig_nodes << "%" << endl;
-        out << "     Pushed rate (avg, max): " << pushed_rate_sum/R.size() << ", " << pushed_rate_max/R.size() << "    [states/bp] (states normalized by query length)" << endl;
-        out << "     Popped rate (avg, max): " << popped_rate_sum/R.size() << ", " << popped_rate_max/R.size() << endl;
+        out << "     Pushed rate (avg, max): " << pushed_rate_sum/R.size() << ", " << pushed_rate_max << "    [states/bp] (states normalized by query length)" << endl;
+        out << "     Popped rate (avg, max): " << popped_rate_sum/R.size() << ", " << popped_rate_max << endl;
+        out << " Align time (p50, p99, max): " << hists.wall_ns.percentile(0.5) / 1e6 << ", " << hists.wall_ns.percentile(0.99) / 1e6 << ", "
+                                            << hists.wall_ns.max() / 1e6 << " [ms per read] (distributions in hist.log)" << endl;
         out << "             Average popped: " << 1.0 * popped_trie_total.load() / (R.size()/args.threads)
                                             << " from trie (" << 100.0*popped_trie_total.load()/(popped_trie_total.load() + popped_ref_total.load()) << "%) vs "
                                             << 1.0 * popped_ref_total.load() / (R.size()/args.threads) << " from ref"  << " (per read)" << endl;
+        if (align_params.prefix_cache_size > 0)
+            out << "          Prefix cache hits: " << global_stats.prefix_cache_hits << " (" << 100.0*global_stats.prefix_cache_hits.get()/R.size() << "% of reads)" << endl;
         out << "Total cost of aligned reads: " << global_stats.align_status.cost.get() << ", " << 1.*global_stats.align_status.cost.get()/global_stats.align_status.aligned() << " per read, " 
             << 100.0*global_stats.align_status.cost.get()/size_sum(R) << "% per letter" << endl;
+        if (astar->is_dynamic())
+            out << "   Re-evaluated states (avg): " << 1.0*global_stats.reevaluated.get() / size_sum(R) << " states/read_bp" << endl;
 #ifndef NDEBUG
         out << "      Repeated states (avg): " << 1.0*global_stats.repeated_visits.get() / size_sum(R) << " states/read_bp" << endl;
 #endif
@@ -510,6 +689,20 @@ int exec_astarix(int argc, char **argv) {
         out << "                    trie: " << T.construct_trie.m.get_gb() << "gb, " << 100.0*T.construct_trie.m.get_gb() / total_mem << "% | " << 100.0*b2gb(G.trie_mem_bytes()) / total_mem << "%" << endl;
         out << "     equiv. classes opt.: " << T.precompute.m.get_gb() << "gb, " << 100.0*T.precompute.m.get_gb() / total_mem << "%" << endl;
         out << "          A*-memoization: " << T.align.m.get_gb() << "gb, " << 100.0*T.align.m.get_gb() / total_mem << endl;
+        if (args.huge_pages != HUGE_PAGES_OFF)
+            out << "            graph arrays: " << b2gb(mapped_page_bytes()) << "gb mapped, "
+                                            << b2gb(explicit_huge_page_bytes()) << "gb on explicit huge pages, "
+                                            << b2gb(anon_huge_page_bytes()) << "gb on transparent huge pages (process)" << endl;
+        if (args.numa_node != -1)
+            out << "               NUMA node: " << args.numa_node << ", " << b2gb(unbound_page_bytes()) << "gb of graph arrays unbound" << endl;
+        if (TRACKING_ALLOCS) {
+            out << "    Allocations:        count, allocated | peak live" << endl;
+            for (int tag=0; tag<ALLOC_TAGS; tag++) {
+                alloc_counts_t c = alloc_counts(alloc_tag_t(tag));
+                out << setw(24) << alloc_tag_names[tag] << ": " << c.allocs << ", " << b2gb(c.bytes) << "gb | " << b2gb(c.peak_bytes) << "gb" << endl;
+            }
+            out << "        per aligned read: " << hists.allocs.mean() * hists.allocs.count() / global_stats.align_status.aligned() << endl;
+        }
         out << endl;
         out << "   Total wall runtime:    " << total_wt.count() << "s"                  << endl;
         out << "       reference loading: " << T.read_graph.t.get_sec() << "s"          << endl;
@@ -524,8 +717,12 @@ int exec_astarix(int argc, char **argv) {
                                             << R.size() / align_cpu_time << " reads/s = "
                                             << size_sum(R) / 1000.0 / align_cpu_time << " Kbp/s"    << endl; 
         out << "     |          Preprocessing: " << 100.0 * global_stats.t.astar_prepare_reads.get_sec() / align_cpu_time << "%" << endl;
-        out << "     |               A* query: " << 100.0 * global_stats.t.astar.get_sec() / align_cpu_time << "%"   << endl;
-        out << "     |           greedy_match: " << 100.0 * global_stats.t.ff.get_sec() / align_cpu_time << "%" << endl;
+        if (INSTRUMENTED) {
+            out << "     |               A* query: " << 100.0 * global_stats.t.astar.get_sec() / align_cpu_time << "%"   << endl;
+            out << "     |           greedy_match: " << 100.0 * global_stats.t.ff.get_sec() / align_cpu_time << "%" << endl;
+        } else {
+            out << "     |   A* query, greedy_match: - (built with INSTRUMENT=0)" << endl;
+        }
         out << "     |                  other: " << 100.0 - 100.0 * (global_stats.t.astar_prepare_reads.get_sec() + global_stats.t.astar.get_sec() + global_stats.t.ff.get_sec()) / align_cpu_time << "%" << endl;
         out << " DONE" << endl;
         out << endl;
@@ -533,6 +730,17 @@ int exec_astarix(int argc, char **argv) {
 
     extract_args_to_dict(args, &stats);
     T.extract_to_dict(&stats);
+    if (args.perf_counters)
+        T.extract_perf_to_dict(aligner.perf, &stats);
+    if (TRACKING_ALLOCS) {
+        for (int tag=0; tag<ALLOC_TAGS; tag++) {
+            alloc_counts_t c = alloc_counts(alloc_tag_t(tag));
+            stats[string("alloc_") + alloc_tag_names[tag] + "_count"] = to_string(c.allocs);
+            stats[string("alloc_") + alloc_tag_names[tag] + "_bytes"] = to_string(c.bytes);
+            stats[string("alloc_") + alloc_tag_names[tag] + "_peak_bytes"] = to_string(c.peak_bytes);
+        }
+        stats["allocs_per_aligned_read"] = to_string(hists.allocs.mean() * hists.allocs.count() / global_stats.align_status.aligned());
+    }
 
     {
         ofstream tsv(stats_file);
@@ -540,6 +748,11 @@ int exec_astarix(int argc, char **argv) {
         tsv.close();
     }
 
+    if (!hist_file.empty()) {
+        ofstream hist(hist_file);
+        hists.print(hist);
+    }
+
 
     return 0;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -9,11 +10,15 @@
 
 namespace astarix {
 
-class DijkstraDummy: public AStarHeuristic {
+class DijkstraDummy final: public AStarHeuristic {
   public:
     cost_t h(const state_t &st) const {
         return 0;
     }
+
+    void h_batch(const state_t *st, size_t n, cost_t *hs) const {
+        std::fill(hs, hs+n, cost_t(0));
+    }
 };
 
 }
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace astarix {
+
+// FM-index of a text over the letters 0..3 (see nucl2num) and a separator. Each row of the BWT is the
+// rank of a suffix of the text; the rows of the suffixes starting with a pattern form an interval.
+// Occurrence counts are stored in blocks of 64 rows. Some rows keep a sampled value (e.g. the position
+// of their suffix) which the others reach by LF-mapping.
+class FMIndex {
+  public:
+    static constexpr uint8_t SEP = 4;
+
+  private:
+    struct Block {
+        uint32_t occ[4];         // occurrences of each letter in the BWT before the block
+        uint32_t samples;        // sampled rows before the block
+        uint64_t lo, hi, sep;    // low and high bits of the BWT letters; sep marks separators
+        uint64_t sampled;        // marks the sampled rows
+    };
+
+    int n;
+    int C[4];                    // C[k] -- rows of suffixes starting with a separator or a letter smaller than k
+    std::vector<Block> blocks;
+    std::vector<int> samples;
+
+    static uint64_t lower_bits(int row) {
+        return (uint64_t(1) << (row%64)) - 1;
+    }
+
+    // Suffix array of s by prefix doubling with radix sort; a suffix is smaller than its extensions.
+    static std::vector<int> suffix_array(const std::vector<uint8_t> &s, int sigma) {
+        int n = s.size();
+        std::vector<int> sa(n), rank(s.begin(), s.end()), tmp(n), cnt;
+        for (int i=0; i<n; i++)
+            sa[i] = i;
+        std::sort(sa.begin(), sa.end(), [&](int a, int b) { return s[a] < s[b]; });
+
+        for (int k=1; n>0; k*=2) {
+            // Sort by (rank[i], rank[i+k]) where a missing rank[i+k] is the smallest.
+            int p = 0;
+            for (int i=n-k; i<n; i++)
+                if (i >= 0)
+                    tmp[p++] = i;
+            for (int j=0; j<n; j++)
+                if (sa[j] >= k)
+                    tmp[p++] = sa[j]-k;
+            cnt.assign(std::max(n, sigma)+1, 0);
+            for (int i=0; i<n; i++)
+                ++cnt[rank[i]+1];
+            for (size_t r=1; r<cnt.size(); r++)
+                cnt[r] += cnt[r-1];
+            for (int j=0; j<n; j++)
+                sa[cnt[rank[tmp[j]]]++] = tmp[j];
+
+            auto second = [&](int i) { return i+k < n ? rank[i+k] : -1; };
+            tmp[sa[0]] = 0;
+            for (int j=1; j<n; j++)
+                tmp[sa[j]] = tmp[sa[j-1]] + (rank[sa[j]] != rank[sa[j-1]] || second(sa[j]) != second(sa[j-1]));
+            rank.swap(tmp);
+            if (rank[sa[n-1]] == n-1)
+                break;
+        }
+        return sa;
+    }
+
+  public:
+    FMIndex() : n(0), C{0, 0, 0, 0} {}
+
+    // Indexes the text; sample_value(i) is the value kept for the suffix starting at i, or -1 if none.
+    void build(const std::vector<uint8_t> &text, std::function<int(int)> sample_value) {
+        n = text.size();
+        std::vector<uint8_t> s(n);  // separators are the smallest
+        for (int i=0; i<n; i++)
+            s[i] = text[i] == SEP ? 0 : text[i]+1;
+        std::vector<int> sa = suffix_array(s, 5);
+        std::vector<uint8_t>().swap(s);
+
+        int seps = 0;
+        int cnt[4] = {0, 0, 0, 0};
+        for (uint8_t c: text)
+            if (c == SEP) ++seps;
+            else ++cnt[c];
+        C[0] = seps;
+        for (int k=1; k<4; k++)
+            C[k] = C[k-1] + cnt[k-1];
+
+        Block empty = {{0, 0, 0, 0}, 0, 0, 0, 0, 0};
+        blocks.assign(n/64 + 1, empty);
+        samples.clear();
+        uint32_t occ[4] = {0, 0, 0, 0};
+        for (int row=0; row<=n; row++) {
+            Block &b = blocks[row/64];
+            if (row%64 == 0) {
+                std::copy(occ, occ+4, b.occ);
+                b.samples = samples.size();
+            }
+            if (row == n)
+                break;
+            uint64_t bit = uint64_t(1) << (row%64);
+            uint8_t c = sa[row] > 0 ? text[sa[row]-1] : SEP;
+            if (c == SEP) {
+                b.sep |= bit;
+            } else {
+                if (c & 1) b.lo |= bit;
+                if (c & 2) b.hi |= bit;
+                ++occ[c];
+            }
+            int value = sample_value(sa[row]);
+            if (value != -1) {
+                b.sampled |= bit;
+                samples.push_back(value);
+            }
+        }
+        samples.shrink_to_fit();
+    }
+
+    int size() const {
+        return n;
+    }
+
+    // Rows of all suffixes (the empty pattern).
+    std::pair<int, int> all() const {
+        return std::make_pair(0, n);
+    }
+
+    // Occurrences of letter k in the BWT before a row.
+    int occ(int k, int row) const {
+        const Block &b = blocks[row/64];
+        uint64_t bits = (k & 1 ? b.lo : ~b.lo) & (k & 2 ? b.hi : ~b.hi) & ~b.sep;
+        return b.occ[k] + __builtin_popcountll(bits & lower_bits(row));
+    }
+
+    // Rows of the suffixes starting with letter k followed by the pattern of `rows` (backward search).
+    std::pair<int, int> extend(std::pair<int, int> rows, int k) const {
+        return std::make_pair(C[k] + occ(k, rows.first), C[k] + occ(k, rows.second));
+    }
+
+    // The letter before the suffix of a row, or SEP.
+    int bwt(int row) const {
+        const Block &b = blocks[row/64];
+        int r = row%64;
+        if ((b.sep >> r) & 1)
+            return SEP;
+        return ((b.lo >> r) & 1) | (((b.hi >> r) & 1) << 1);
+    }
+
+    // Row of the suffix starting one letter earlier.
+    int lf(int row) const {
+        assert(bwt(row) != SEP);
+        int k = bwt(row) & 3;
+        return C[k] + occ(k, row);
+    }
+
+    bool sampled(int row) const {
+        return (blocks[row/64].sampled >> (row%64)) & 1;
+    }
+
+    int sample(int row) const {
+        assert(sampled(row));
+        const Block &b = blocks[row/64];
+        return samples[b.samples + __builtin_popcountll(b.sampled & lower_bits(row))];
+    }
+
+    static size_t block_bytes() {
+        return sizeof(Block);
+    }
+
+    size_t mem_bytes() const {
+        return blocks.size() * sizeof(Block) + samples.size() * sizeof(int);
+    }
+};
+
+}
@@ -26,7 +26,7 @@ GfaGraph load_gfa(const std::string &gfa_filename) {
 void gfa2graph(GfaGraph &gfa, astarix::graph_t *G) {
     LOG_INFO << "GFA to Internal graph";
 
-    std::unordered_map<int, int> node2idx;
+    std::unordered_map<int, astarix::node_t> node2idx;
 
     for (const auto &node: gfa.nodes) {
         node2idx[node.first] = G->add_node();
@@ -34,9 +34,9 @@ void gfa2graph(GfaGraph &gfa, astarix::graph_t *G) {
     }
 
     for (const auto &node: gfa.nodes) {
-        int curr = node2idx[node.first];
+        astarix::node_t curr = node2idx[node.first];
         for (size_t j=0; j<node.second.size()-1; j++) {
-            int next = G->add_node();
+            astarix::node_t next = G->add_node();
             G->add_edge(curr, next, node.second[j], astarix::ORIG);
             curr = next;
         }
@@ -1,3 +1,5 @@
+#include <mutex>
+
 #include "graph.h"
 
 namespace astarix {
@@ -7,4 +9,239 @@ std::ostream& operator<<(std::ostream& os, const state_t &st) {
     return os;
 }
 
-}
\ No newline at end of file
+// The edges of each node keep their order within a label, so ties between paths resolve as before for
+// nodes with different labels on their edges.
+void graph_t::group_edges_by_label() {
+    graph_vector<edge_t> grouped;
+    std::vector<edge_t> out;
+    grouped.reserve(E.size());
+    graph_vector<uint8_t> mask(V.size(), 0);
+    for (node_t v=0; v<(node_t)V.size(); v++) {
+        out.clear();
+        for (edge_idx_t idx=V[v]; idx!=-1; idx=E[idx].next)
+            out.push_back(E[idx]);
+        std::stable_sort(out.begin(), out.end(), [](const edge_t &a, const edge_t &b) {
+            return a.label < b.label; });
+
+        bool unique = true;
+        for (const edge_t &e: out) {
+            int k = nucl_index(e.label);
+            if (k == -1)
+                mask[v] |= LABELS_SUBSETS;
+            if (k == -1 || (mask[v] >> k) & 1)
+                unique = false;
+            mask[v] |= nucl_mask(e.label);
+        }
+        if (unique)
+            mask[v] |= LABELS_UNIQUE;
+
+        V[v] = out.empty() ? -1 : (edge_idx_t)grouped.size();
+        for (size_t j=0; j<out.size(); j++) {
+            out[j].next = j+1 < out.size() ? (edge_idx_t)grouped.size()+1 : -1;
+            grouped.push_back(out[j]);
+        }
+    }
+    E.swap(grouped);
+    label_mask.swap(mask);
+}
+
+// Nodes come in the order of the input (GFA segments in hash map order) with each strand in its own
+// half, so the nodes of a walk may be far apart. A breadth-first search from the nodes without
+// incoming edges keeps the nodes of a path consecutive and the branches of a bubble side by side.
+// The reverse strand mirrors the new order of the forward one (see node2revcompl).
+void graph_t::reorder_nodes_bfs() {
+    assert(reverse_first_node != -1 && trie_first_node == -1);
+    node_t half = reverse_first_node;
+    std::vector<node_t> order(1, 0);  // forward nodes by new id
+    order.reserve(half);
+    std::vector<bool> seen(half, false);
+    seen[0] = true;
+    auto bfs = [&](node_t s) {
+        seen[s] = true;
+        order.push_back(s);
+        for (size_t head=order.size()-1; head<order.size(); head++)
+            for (edge_idx_t idx=V[order[head]]; idx!=-1; idx=E[idx].next) {
+                node_t v = E[idx].to;
+                if (!seen[v]) {
+                    seen[v] = true;
+                    order.push_back(v);
+                }
+            }
+    };
+    for (node_t u=1; u<half; u++)
+        if (!seen[u] && !hasIncomingEdges(u))
+            bfs(u);
+    for (node_t u=1; u<half; u++)  // cycles
+        if (!seen[u])
+            bfs(u);
+
+    std::vector<node_t> old_id(V.size()), new_id(V.size());
+    for (node_t v=0; v<half; v++) {
+        old_id[v] = order[v];
+        old_id[v + half] = order[v] + half;
+    }
+    for (node_t v=0; v<(node_t)V.size(); v++)
+        new_id[old_id[v]] = v;
+
+    // Rebuild the lists so that the edges of each node are consecutive, keeping their order.
+    auto renumber = [&](graph_vector<edge_t> &edges, graph_vector<nodesz> &first) {
+        graph_vector<edge_t> out;
+        graph_vector<nodesz> out_first(first.size(), -1);
+        out.reserve(edges.size());
+        for (node_t v=0; v<(node_t)first.size(); v++) {
+            size_t start = out.size();
+            for (edge_idx_t idx=first[old_id[v]]; idx!=-1; idx=edges[idx].next) {
+                edge_t e = edges[idx];
+                e.to = new_id[e.to];
+                e.next = out.size() + 1;
+                out.push_back(e);
+            }
+            if (out.size() > start) {
+                out_first[v] = start;
+                out.back().next = -1;
+            }
+        }
+        edges.swap(out);
+        first.swap(out_first);
+    };
+    renumber(E, V);
+    renumber(E_rev, V_rev);
+    label_mask.clear();
+}
+
+// Nodes of the lazy trie are only added and expanded under the unique lock, and an expanded node never
+// changes, so its edges can be read after the lock is released.
+const lazy_trie_node_t *graph_t::lazy_trie_expand(node_t v) const {
+    AllocScope scope(ALLOC_TRIE);
+    {
+        std::shared_lock<std::shared_mutex> lock(lazy_trie_mutex);
+        auto it = lazy_trie_nodes.find(v);
+        if (it != lazy_trie_nodes.end() && it->second->expanded)
+            return it->second.get();
+    }
+    std::unique_lock<std::shared_mutex> lock(lazy_trie_mutex);
+    return lazy_trie_expand_locked(v);
+}
+
+// The reference nodes ending the walks which spell the prefix of v, continuing from the nearest
+// ancestor which kept its frontier (or from the root).
+std::vector<node_t> graph_t::lazy_trie_walk_ends(node_t v) const {
+    std::vector<int> letters;
+    node_t a = v;
+    for (; a != 0; a = trie_parent(a)) {
+        const lazy_trie_node_t *x = lazy_trie_nodes.at(a).get();
+        if (x->expanded && !x->frontier.empty())
+            break;
+        letters.push_back((a - trie_level_first[trie_node_depth(a)]) % 4);
+    }
+
+    std::vector<node_t> ends, next;
+    if (a == 0)
+        for (node_t u=1; u<trie_first_node; u++)
+            ends.push_back(u);
+    else
+        ends = lazy_trie_nodes.at(a)->frontier;
+    for (auto k=letters.rbegin(); k!=letters.rend(); ++k) {
+        next.clear();
+        for (node_t u: ends)
+            for (edge_idx_t idx=V[u]; idx!=-1; idx=E[idx].next)
+                if (E[idx].type == ORIG && ((trie_mask(E[idx].label) >> *k) & 1))
+                    next.push_back(E[idx].to);
+        std::sort(next.begin(), next.end());
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        ends.swap(next);
+    }
+    return ends;
+}
+
+lazy_trie_node_t *graph_t::lazy_trie_expand_locked(node_t v) const {
+    auto it = lazy_trie_nodes.find(v);
+    if (it == lazy_trie_nodes.end()) {
+        // Not reached from an expanded parent yet.
+        if (v == 0 || !lazy_trie_expand_locked(trie_parent(v)))
+            return nullptr;
+        it = lazy_trie_nodes.find(v);
+        if (it == lazy_trie_nodes.end())
+            return nullptr;
+    }
+
+    lazy_trie_node_t *x = it->second.get();
+    if (x->expanded)
+        return x;
+
+    if (x->frontier_dropped)
+        x->frontier = lazy_trie_walk_ends(v);
+    if (v == 0)
+        for (node_t u=1; u<trie_first_node; u++)
+            x->frontier.push_back(u);
+
+    bool to_reference = v != 0 && v >= trie_level_first[trie_depth-1];
+    std::vector<node_t> child_frontier[4];
+    for (node_t u: x->frontier)
+        for (edge_idx_t idx=V[u]; idx!=-1; idx=E[idx].next) {
+            const edge_t &e = E[idx];
+            assert(e.type == ORIG);
+            if (v != 0 && trie_exit(e.label)) {
+                for (int k=0; k<4; k++)
+                    x->edges.push_back(edge_t(v, e.to, nucls[k], -1, JUMP));
+                continue;
+            }
+            for (int k=0; k<4; k++)
+                if ((trie_mask(e.label) >> k) & 1) {
+                    if (to_reference)
+                        x->edges.push_back(edge_t(v, e.to, nucls[k], -1, JUMP));
+                    else
+                        child_frontier[k].push_back(e.to);
+                }
+        }
+
+    if (to_reference) {
+        if (!x->frontier_dropped)
+            lazy_trie_bytes -= x->frontier.size() * sizeof(node_t);
+        std::vector<node_t>().swap(x->frontier);  // replaced by the edges
+    } else {
+        // The frontiers of the children are kept if they fit under the ceiling. Otherwise, the children
+        // continue from the kept frontier of v or of an ancestor (see lazy_trie_walk_ends).
+        size_t child_bytes = 0;
+        for (int k=0; k<4; k++) {
+            std::vector<node_t> &f = child_frontier[k];
+            std::sort(f.begin(), f.end());
+            f.erase(std::unique(f.begin(), f.end()), f.end());
+            child_bytes += f.size() * sizeof(node_t);
+        }
+        bool keep = lazy_trie_bytes + child_bytes <= lazy_trie_max_bytes;
+        for (int k=0; k<4; k++) {
+            if (child_frontier[k].empty())
+                continue;
+            node_t child = trie_child_id(v, k);
+            auto &y = lazy_trie_nodes[child];
+            y.reset(new lazy_trie_node_t());
+            if (keep)
+                y->frontier.swap(child_frontier[k]);
+            else
+                y->frontier_dropped = true;
+            x->edges.push_back(edge_t(v, child, nucls[k], -1, JUMP));
+        }
+        if (keep) {
+            lazy_trie_bytes += child_bytes;
+            if (v != 0 && !x->frontier_dropped)
+                lazy_trie_bytes -= x->frontier.size() * sizeof(node_t);
+            std::vector<node_t>().swap(x->frontier);
+        } else if (x->frontier_dropped || v == 0) {
+            std::vector<node_t>().swap(x->frontier);  // not counted: continue from a further ancestor
+        }
+    }
+    // The children and the exits (see trie_exit) or the edges to the reference, by label.
+    std::sort(x->edges.begin(), x->edges.end(), [](const edge_t &a, const edge_t &b) {
+        return a.label != b.label ? a.label < b.label : a.to < b.to; });
+    x->edges.erase(std::unique(x->edges.begin(), x->edges.end(), [](const edge_t &a, const edge_t &b) {
+        return a.label == b.label && a.to == b.to; }), x->edges.end());
+    for (size_t j=0; j<x->edges.size(); j++)
+        x->edges[j].next = j+1 < x->edges.size() ? j+1 : -1;
+    x->edges.shrink_to_fit();
+    lazy_trie_bytes += x->edges.size() * sizeof(edge_t);
+    x->expanded = true;
+    return x;
+}
+
+}
@@ -1,15 +1,24 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <climits>
+#include <cstdint>
 #include <fstream>
 #include <memory.h>
+#include <memory>
 #include <iostream>
 #include <set>
+#include <shared_mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <plog/Log.h>
 
+#include "fm-index.h"
+#include "alloc-track.h"
+#include "page-alloc.h"
 #include "utils.h"
 
 namespace astarix {
@@ -53,6 +62,16 @@ std::ostream& operator<<(std::ostream& os, const state_t &st);
 typedef std::vector<state_t> path_t;
 typedef std::vector<edge_t> edge_path_t;
 
+// A node of the lazy trie. Its edges are built the first time it is expanded and never change after.
+struct lazy_trie_node_t {
+    std::vector<node_t> frontier;  // reference nodes ending the walks which spell the node (until expanded)
+    bool frontier_dropped;         // the frontier was not kept because of the memory ceiling
+    bool expanded;
+    std::vector<edge_t> edges;     // JUMP edges to the children or to the reference, linked by next
+
+    lazy_trie_node_t() : frontier_dropped(false), expanded(false) {}
+};
+
 struct graph_t {
  // node index
  // [0]                      				-- trie root
@@ -60,30 +79,70 @@ struct graph_t {
  // [reverse_first_node]                    -- mirrored trie root
  // [reverse_first_node+1; trie_first_node) -- reverse graph
  // >= trie_first_node; 					-- trie (except root)
+ //
+ // With a fixed trie depth D, the trie is implicit: the node at depth 0<d<D spelling a prefix with
+ // code c (base 4, the first letter is most significant) is trie_level_first[d] + c. Only the
+ // presence of each such node is stored, together with the edges from depth D-1 to the reference.
+ // For a linear reference, the presence and the edges to the reference can instead come from an
+ // FM-index of the reference text (fm_trie). In a lazy trie, the edges of a node are built when it is
+ // first expanded (lazy_trie).
 
   //private:
     //mutable cost_t _min_edge_cost;
     //mutable cost_t _min_edit_cost;
 
   public:
-    std::vector<edge_t> E;  // n linked lists emulated in a stack E
-    std::vector<int> V;     // E[ V[i] ] -- last added outgoing edge from vertex i
+    graph_vector<edge_t> E;  // n linked lists emulated in a stack E
+    graph_vector<nodesz> V;  // E[ V[i] ] -- last added outgoing edge from vertex i
     // if a node with number 0 exists, it is a supersource
 
     // reverse edges
-    std::vector<edge_t> E_rev;  // n linked lists emulated in a stack E
-    std::vector<int> V_rev;     // E[ V[i] ] -- last added outgoing edge from vertex i
+    graph_vector<edge_t> E_rev;  // n linked lists emulated in a stack E
+    graph_vector<nodesz> V_rev;  // E[ V[i] ] -- last added outgoing edge from vertex i
 
-    int orig_nodes, orig_edges;
+    // Label index (see group_edges_by_label): the outgoing edges of each node are consecutive in E and
+    // sorted by label; bit k of label_mask[v] tells if an edge of v matches nucls[k], LABELS_UNIQUE
+    // that each edge of v has a different nucleotide label, and LABELS_SUBSETS that some edge is labeled
+    // by a subset of nucleotides (see nucl_mask). Empty if not built or if edges were added.
+    graph_vector<uint8_t> label_mask;
+    static const uint8_t LABELS_UNIQUE = 16;
+    static const uint8_t LABELS_SUBSETS = 32;
+
+    node_t orig_nodes;
+    edge_idx_t orig_edges;
 
     const char *EdgeTypeStr[5];
 	node_t reverse_first_node;
     node_t trie_first_node;
-	int trie_depth, trie_nodes, trie_edges;
+	int trie_depth;
+    node_t trie_nodes;
+    edge_idx_t trie_edges;
     bool fixed_trie_depth;
 
+    // Implicit trie
+    bool implicit_trie;
+    std::vector<node_t> trie_level_first;    // trie_level_first[d] -- the first node at depth d; [D] is past the deepest level
+    graph_vector<uint64_t> trie_present;     // bit v-trie_first_node -- whether the prefix of node v occurs in the reference
+    graph_vector<node_t> trie_present_rank;  // trie_present_rank[w] -- number of present nodes before the word trie_present[w]
+    graph_vector<edge_idx_t> trie_leaf_first;  // edges of the k-th present node at depth D-1 are trie_leaf_edges[trie_leaf_first[k], trie_leaf_first[k+1])
+    graph_vector<edge_t> trie_leaf_edges;    // JUMP edges to the reference sorted by source, then by label
+    graph_vector<node_t> trie_exit_from;     // sources of trie_exit_edges
+    graph_vector<edge_t> trie_exit_edges;    // JUMP edges to the reference from above depth D-1 (see trie_exit), sorted as trie_leaf_edges
+
+    // FM-index trie
+    bool fm_trie;
+    FMIndex fm;                              // of the reversed reference text: backward search extends a prefix forward; samples are nodes
+
+    // Lazy trie
+    bool lazy_trie;
+    size_t lazy_trie_max_bytes;              // ceiling for the kept frontiers (the edges are always kept)
+    mutable size_t lazy_trie_bytes;
+    mutable std::shared_mutex lazy_trie_mutex;
+    mutable std::unordered_map<node_t, std::unique_ptr<lazy_trie_node_t>> lazy_trie_nodes;
+
     graph_t(bool _with_reverse_edges=0)
-            : orig_nodes(0), orig_edges(0), reverse_first_node(-1), trie_first_node(-1), trie_depth(0), trie_nodes(0), trie_edges(0)
+            : orig_nodes(0), orig_edges(0), reverse_first_node(-1), trie_first_node(-1), trie_depth(0), trie_nodes(0), trie_edges(0),
+              fixed_trie_depth(false), implicit_trie(false), fm_trie(false), lazy_trie(false), lazy_trie_max_bytes(0), lazy_trie_bytes(0)
             //: with_reverse_edges(_with_reverse_edges)
             {
         V.resize(1, -1);  // 0 preserved for a supersource
@@ -124,32 +183,212 @@ struct graph_t {
         return trie_depth;
     }
 
+    bool node_in_implicit_trie(node_t v) const {
+        return implicit_trie && node_in_trie(v);
+    }
+
+    // Prepares the (empty) implicit trie of the given depth right after the reference nodes.
+    void init_implicit_trie(int depth) {
+        assert(depth >= 2);
+        trie_first_node = nodes();
+        implicit_trie = true;
+        trie_depth = depth;
+        trie_level_first.assign(depth+1, 0);
+        long long first = trie_first_node, level_size = 4;
+        for (int d=1; d<=depth; d++, level_size *= 4) {
+            if (first > MAX_IDS)
+                throw "Trie depth too big for the implicit trie.";
+            trie_level_first[d] = first;
+            if (d < depth)
+                first += level_size;
+        }
+        if (!fm_trie && !lazy_trie)
+            trie_present.assign((trie_level_first[depth] - trie_first_node + 63) / 64, 0);
+    }
+
+    // Safe to call from multiple threads.
+    void set_trie_present(node_t v) {
+        node_t b = v - trie_first_node;
+        std::atomic_ref<uint64_t>(trie_present[b/64]).fetch_or(uint64_t(1) << (b%64), std::memory_order_relaxed);
+    }
+
+    bool trie_node_present(node_t v) const {
+        if (lazy_trie)
+            return lazy_trie_expand(v) != nullptr;
+        if (fm_trie) {
+            auto rows = fm_interval(v);
+            return rows.first < rows.second;
+        }
+        node_t b = v - trie_first_node;
+        return (trie_present[b/64] >> (b%64)) & 1;
+    }
+
+    // Number of present implicit trie nodes before v.
+    node_t trie_present_before(node_t v) const {
+        node_t b = v - trie_first_node;
+        uint64_t lower_bits = (uint64_t(1) << (b%64)) - 1;
+        return trie_present_rank[b/64] + __builtin_popcountll(trie_present[b/64] & lower_bits);
+    }
+
+    // Number of letters from the trie root to a trie node.
+    int trie_node_depth(node_t v) const {
+        if (v == 0)
+            return 0;
+        if (!implicit_trie) {
+            int d = 0;
+            for (; v != 0; v = E_rev[V_rev[v]].to)  // the only incoming edge is from the parent
+                ++d;
+            return d;
+        }
+        int d = 1;
+        while (v >= trie_level_first[d+1])
+            ++d;
+        return d;
+    }
+
+    // Parent of a node of the implicit trie other than the root.
+    node_t trie_parent(node_t v) const {
+        int d = trie_node_depth(v);
+        return d == 1 ? 0 : trie_level_first[d-1] + (v - trie_level_first[d]) / 4;
+    }
+
+    // Node of the implicit trie spelling the prefix of v followed by the k-th nucleotide.
+    node_t trie_child_id(node_t v, int k) const {
+        if (v == 0)
+            return trie_level_first[1] + k;
+        int d = trie_node_depth(v);
+        return trie_level_first[d+1] + 4*(v - trie_level_first[d]) + k;
+    }
+
+    // Node of the implicit trie reached from v by the k-th nucleotide, or -1.
+    node_t trie_child(node_t v, int k) const {
+        node_t child = trie_child_id(v, k);
+        return trie_node_present(child) ? child : -1;
+    }
+
+    // Rows of the FM-index with the prefix spelled by the implicit trie node v.
+    std::pair<int, int> fm_interval(node_t v) const {
+        auto rows = fm.all();
+        if (v == 0)
+            return rows;
+        int d = trie_node_depth(v);
+        node_t code = v - trie_level_first[d];
+        for (int i=d-1; i>=0 && rows.first<rows.second; i--)
+            rows = fm.extend(rows, (code >> (2*i)) & 3);
+        return rows;
+    }
+
+    // The reference node following the prefix of an FM-index row: LF-mapping reaches a sampled row a
+    // few letters later, from which the (unique) incoming edges lead back.
+    node_t fm_locate(int row) const {
+        int steps = 0;
+        for (; !fm.sampled(row); steps++)
+            row = fm.lf(row);
+        node_t u = fm.sample(row);
+        for (; steps>0; steps--) {
+            assert(V_rev[u] != -1 && E_rev[V_rev[u]].type == ORIG);
+            u = E_rev[V_rev[u]].to;
+        }
+        return u;
+    }
+
+    // Range of trie_leaf_edges from a node at the deepest level of the implicit trie.
+    std::pair<edge_idx_t, edge_idx_t> trie_leaf_range(node_t v) const {
+        if (!trie_node_present(v))
+            return std::make_pair(0, 0);
+        node_t k = trie_present_before(v) - trie_present_before(trie_level_first[trie_depth-1]);
+        return std::make_pair(trie_leaf_first[k], trie_leaf_first[k+1]);
+    }
+
+    // Range of trie_exit_edges from a node above the deepest level of the implicit trie.
+    std::pair<edge_idx_t, edge_idx_t> trie_exit_range(node_t v) const {
+        auto range = std::equal_range(trie_exit_from.begin(), trie_exit_from.end(), v);
+        return std::make_pair(edge_idx_t(range.first - trie_exit_from.begin()), edge_idx_t(range.second - trie_exit_from.begin()));
+    }
+
+    // Appends the reverse edges from a reference node v to an FM-index or a lazy trie: one to the
+    // deepest level for each prefix of trie_depth letters spelled by a walk ending at v, and the exits
+    // of the walks ending with an N into v (see trie_exit). The edges already in parents are kept.
+    void implicit_trie_parents(node_t v, std::vector<edge_t> *parents) const {
+        size_t from = parents->size();
+        add_trie_parents(v, v, 0, 0, EPS, parents);
+        std::sort(parents->begin() + from, parents->end(), [](const edge_t &a, const edge_t &b) {
+            return a.to != b.to ? a.to < b.to : a.label < b.label; });
+        parents->erase(std::unique(parents->begin() + from, parents->end(), [](const edge_t &a, const edge_t &b) {
+            return a.to == b.to && a.label == b.label; }), parents->end());
+    }
+
+    // The lazy trie node v with its edges built, or nullptr if its prefix is not in the reference.
+    // Safe to call from multiple threads (see graph.cpp).
+    const lazy_trie_node_t *lazy_trie_expand(node_t v) const;
+
+  private:
+    // Continues the walk back from v to u over `len` letters; the letters before the last one form `code`,
+    // which fits in node_t since init_implicit_trie rejects depths with more nodes than MAX_IDS. After
+    // an N into v, each trie node spelled by the letters before it exits to v.
+    void add_trie_parents(node_t v, node_t u, int len, node_t code, label_t label, std::vector<edge_t> *parents) const {
+        if (trie_exit(label) && len >= 2)
+            for (int k=0; k<4; k++)
+                parents->push_back(edge_t::from_cost(v, trie_level_first[len-1] + code, nucls[k], JUMP));
+        if (len == trie_depth) {
+            if (!trie_exit(label))
+                parents->push_back(edge_t::from_cost(v, trie_level_first[trie_depth-1] + code, label, JUMP));
+            return;
+        }
+        for (edge_idx_t idx=V_rev[u]; idx!=-1; idx=E_rev[idx].next) {
+            const edge_t &e = E_rev[idx];
+            if (e.type != ORIG)
+                continue;
+            if (len == 0 && trie_exit(e.label))
+                add_trie_parents(v, e.to, 1, 0, e.label, parents);
+            for (int k=0; k<4; k++)
+                if ((trie_mask(e.label) >> k) & 1) {
+                    if (len == 0)
+                        add_trie_parents(v, e.to, 1, 0, nucls[k], parents);
+                    else
+                        add_trie_parents(v, e.to, len+1, code + (node_t(k) << (2*(len-1))), label, parents);
+                }
+        }
+    }
+
+    lazy_trie_node_t *lazy_trie_expand_locked(node_t v) const;
+    std::vector<node_t> lazy_trie_walk_ends(node_t v) const;
+
+  public:
     size_t trie_mem_bytes() const {
+        if (lazy_trie)
+            return lazy_trie_bytes;
+        if (fm_trie)
+            return fm.mem_bytes();
+        if (implicit_trie)
+            return trie_present.size() * sizeof(trie_present.front()) + trie_present_rank.size() * sizeof(node_t)
+                + trie_leaf_first.size() * sizeof(edge_idx_t) + trie_leaf_edges.size() * sizeof(edge_t)
+                + trie_exit_from.size() * sizeof(node_t) + trie_exit_edges.size() * sizeof(edge_t);
         return trie_edges * sizeof(E.front()) + trie_nodes * sizeof(V.front());
     }
 
     size_t total_mem_bytes() const {
-        return E.size() * sizeof(E.front()) + V.size() * sizeof(V.front());
+        return E.size() * sizeof(E.front()) + V.size() * sizeof(V.front()) + label_mask.size() + (implicit_trie ? trie_mem_bytes() : 0);
     }
 
     size_t total_mem_bytes_capacity() const {
-        return E.capacity() * sizeof(E.front()) + V.capacity() * sizeof(V.front());
+        return E.capacity() * sizeof(E.front()) + V.capacity() * sizeof(V.front()) + label_mask.capacity() + (implicit_trie ? trie_mem_bytes() : 0);
     }
 
     size_t reference_mem_bytes() const {
         return total_mem_bytes() - trie_mem_bytes();
     }
 
-    int nodes() const {
-        return V.size();
+    node_t nodes() const {
+        return implicit_trie ? trie_level_first[trie_depth] : V.size();
     }
 
-    int edges() const {
-        return E.size();
+    edge_idx_t edges() const {
+        return E.size() + (implicit_trie ? trie_edges : 0);
     }
 
   public:
-    void init(int _n, int _m) {
+    void init(node_t _n, edge_idx_t _m) {
         V.resize(_n, -1);  // 0 preserved for a supersource
         E.reserve(_m);
 
@@ -158,7 +397,7 @@ struct graph_t {
     }
 
     bool has_supersource() const {
-        return V[0] != -1;
+        return implicit_trie || V[0] != -1;
     }
 
     // TODO: remove
@@ -184,14 +423,15 @@ struct graph_t {
 
 		//std::cerr << a << "->" << b << "(" << label << ")" << std::endl;
 
+        label_mask.clear();
         edge_t e(a, b, label, V[a], type, node_id, offset);
         E.push_back(e);
-        V[a] = (int)E.size()-1;
+        V[a] = (edge_idx_t)E.size()-1;
 
         // rev_edge
         edge_t e_rev(b, a, label, V_rev[b], type, node_id, offset);  // TODO: remove unused params
         E_rev.push_back(e_rev);
-        V_rev[b] = (int)E_rev.size()-1;
+        V_rev[b] = (edge_idx_t)E_rev.size()-1;
     }
 
     void add_seq(node_t from, const std::string &seq, node_t to) {
@@ -202,17 +442,11 @@ struct graph_t {
         add_edge(prev, curr, seq[0], ORIG);
         prev = curr;
 
+        // An extended nucleotide (R, Y, N, ...) labels a single edge matching any of its nucleotides.
         for (std::string::size_type i=1; i<seq.size(); i++) {
             node_t curr = i<seq.size()-1 ? add_node() : to;
-            if (is_nucl(seq[i])) {
-                add_edge(prev, curr, seq[i], ORIG);
-            } else {
-                assert(is_extended_nucl(seq[i]));
-                std::string origs = extended2orignucls(seq[i]);
-                for (char nucl: origs) {
-                    add_edge(prev, curr, nucl, ORIG);
-                }
-            }
+            assert(is_nucl(seq[i]) || is_extended_nucl(seq[i]));
+            add_edge(prev, curr, seq[i], ORIG);
             prev = curr;
         }
     }
@@ -225,10 +459,10 @@ struct graph_t {
 #endif
 
         // prepare the new nodes and edges
-        int half_nodes = V.size();
+        node_t half_nodes = V.size();
         std::vector< std::pair<std::pair<node_t, node_t>, label_t> > new_edges;
-        for (node_t from=0; from<(int)nodes(); from++) {
-            for (int idx=V[from]; idx!=-1; idx=E[idx].next) {
+        for (node_t from=0; from<nodes(); from++) {
+            for (edge_idx_t idx=V[from]; idx!=-1; idx=E[idx].next) {
                 edge_t e = E[idx];
                 new_edges.push_back(std::make_pair(std::make_pair(half_nodes + e.to, half_nodes + from), compl_nucl(e.label)));
             }
@@ -239,7 +473,7 @@ struct graph_t {
 		add_node();  // supersource mirrored
 
         // add the new nodes and edges
-        for (int i=1; i<half_nodes; i++)
+        for (node_t i=1; i<half_nodes; i++)
             add_node();
         for (const auto &e: new_edges)
             add_edge(e.first.first, e.first.second, e.second, astarix::ORIG);
@@ -250,17 +484,17 @@ struct graph_t {
     }
 
     void writeToStdout() const {
-        printf("%d %d\n", (int)nodes(), (int)edges());
-        for (int from=0; from<(int)nodes(); from++) {
-            for (int idx=V[from]; idx!=-1; idx=E[idx].next) {
+        printf("%lld %lld\n", (long long)nodes(), (long long)edges());
+        for (node_t from=0; from<nodes(); from++) {
+            for (edge_idx_t idx=V[from]; idx!=-1; idx=E[idx].next) {
                 edge_t e = E[idx];
-                printf("%d %d %c %s\n", from, (int)e.to, (char)e.label, EdgeTypeStr[e.type]);
+                printf("%lld %lld %c %s\n", (long long)from, (long long)e.to, (char)e.label, EdgeTypeStr[e.type]);
             }
         }
     }
 
     bool hasOutgoingEdges(node_t u) const {
-        for (int idx=V[u]; idx!=-1; idx=E[idx].next) {
+        for (edge_idx_t idx=V[u]; idx!=-1; idx=E[idx].next) {
             if (E[idx].to != u)
                 return true;
         }
@@ -268,7 +502,7 @@ struct graph_t {
     }
 
     bool hasIncomingEdges(node_t u) const {
-        for (int idx=V_rev[u]; idx!=-1; idx=E_rev[idx].next)
+        for (edge_idx_t idx=V_rev[u]; idx!=-1; idx=E_rev[idx].next)
             if (E_rev[idx].type == ORIG)
 				return true;
         return false;
@@ -284,7 +518,7 @@ struct graph_t {
 
     int numInOrigEdges(node_t u, edge_t *e) const {
         int cnt=0;
-        for (int idx=V_rev[u]; idx!=-1; idx=E_rev[idx].next)
+        for (edge_idx_t idx=V_rev[u]; idx!=-1; idx=E_rev[idx].next)
             if (E_rev[idx].type == ORIG) {
                 cnt++;
                 *e = E_rev[idx];
@@ -293,8 +527,16 @@ struct graph_t {
     }
 
     int numOutOrigEdges(node_t u, edge_t *e) const {
+        if (node_in_implicit_trie(u))
+            return 0;  // only JUMP edges
+        if (!label_mask.empty() && (label_mask[u] & LABELS_UNIQUE)) {
+            if (node_in_trie(u) || V[u] == -1)
+                return 0;  // only JUMP edges
+            *e = E[V[u]];
+            return __builtin_popcount(label_mask[u] & 15);
+        }
         int cnt=0;
-        for (int idx=V[u]; idx!=-1; idx=E[idx].next)
+        for (edge_idx_t idx=V[u]; idx!=-1; idx=E[idx].next)
             if (E[idx].type == ORIG) {
                 cnt++;
                 *e = E[idx];
@@ -310,7 +552,46 @@ struct graph_t {
     // Iterator of the original outgoing edges in the graph (excluding edit-edges).
     class orig_edge_iterator {
         const graph_t *g;
-        int curr_edge_idx;
+        const edge_t *edges;  // E, trie_leaf_edges or trie_exit_edges, linked by edge_t::next
+        edge_idx_t curr_edge_idx;  // in edges, or the next child letter of trie_v
+        node_t trie_v;        // a node above the deepest level of the implicit trie (or any node of the FM-index trie) until its exits, or -1
+        std::pair<int, int> fm_rows;   // FM-index rows of trie_v
+        bool fm_leaf;                  // trie_v is at the deepest level of the FM-index trie
+        int fm_row, fm_row_end;        // rows of the edges to the reference with the letter curr_edge_idx
+        edge_t curr;
+
+        void next_trie_child() {
+            for (; curr_edge_idx < 4; curr_edge_idx++) {
+                if (g->fm_trie) {
+                    auto rows = g->fm.extend(fm_rows, curr_edge_idx);
+                    if (rows.first == rows.second)
+                        continue;
+                    node_t to = g->trie_child_id(trie_v, curr_edge_idx);
+                    if (fm_leaf) {
+                        fm_row = rows.first;
+                        fm_row_end = rows.second;
+                        to = g->fm_locate(fm_row);
+                    }
+                    curr = edge_t::from_cost(trie_v, to, nucls[curr_edge_idx], JUMP);
+                    return;
+                }
+                node_t child = g->trie_child(trie_v, curr_edge_idx);
+                if (child != -1) {
+                    curr = edge_t::from_cost(trie_v, child, nucls[curr_edge_idx], JUMP);
+                    return;
+                }
+            }
+            curr_edge_idx = -1;
+            if (!g->fm_trie && !g->trie_exit_edges.empty()) {  // the exits follow the children
+                auto range = g->trie_exit_range(trie_v);
+                if (range.first < range.second) {
+                    trie_v = -1;
+                    edges = g->trie_exit_edges.data();
+                    curr_edge_idx = range.first;
+                    curr = edges[curr_edge_idx];
+                }
+            }
+        }
 
       public:
         using value_type = edge_t;
@@ -320,14 +601,50 @@ struct graph_t {
         using difference_type = void;
 
         orig_edge_iterator(const graph_t *G, node_t _v)
-            : g(G), curr_edge_idx(_v != -1 ? G->V[_v] : -1) {
+            : g(G), edges(G->E.data()), curr_edge_idx(-1), trie_v(-1), fm_leaf(false) {
+            if (_v == -1)
+                return;
+            if (!G->node_in_implicit_trie(_v)) {
+                curr_edge_idx = G->V[_v];
+            } else if (G->lazy_trie) {
+                const lazy_trie_node_t *x = G->lazy_trie_expand(_v);
+                if (x && !x->edges.empty()) {
+                    edges = x->edges.data();
+                    curr_edge_idx = 0;
+                }
+            } else if (G->fm_trie) {
+                trie_v = _v;
+                fm_rows = G->fm_interval(_v);
+                fm_leaf = _v != 0 && _v >= G->trie_level_first[G->trie_depth-1];
+                curr_edge_idx = 0;
+                next_trie_child();
+            } else if (_v != 0 && _v >= G->trie_level_first[G->trie_depth-1]) {
+                auto range = G->trie_leaf_range(_v);
+                edges = G->trie_leaf_edges.data();
+                curr_edge_idx = range.first < range.second ? range.first : -1;
+            } else {
+                trie_v = _v;
+                curr_edge_idx = 0;
+                next_trie_child();
+            }
+            if (trie_v == -1 && curr_edge_idx != -1)
+                curr = edges[curr_edge_idx];
         }
 
-        const reference operator*() const { return g->E[curr_edge_idx]; }
-        pointer operator->() const { return (pointer)&(g->E[curr_edge_idx]); }
+        const reference operator*() const { return curr; }
+        pointer operator->() const { return (pointer)&curr; }
 
         orig_edge_iterator& operator++() {  // preincrement
-            curr_edge_idx = g->E[curr_edge_idx].next;
+            if (fm_leaf && ++fm_row < fm_row_end) {
+                curr.to = g->fm_locate(fm_row);
+            } else if (trie_v != -1) {
+                ++curr_edge_idx;
+                next_trie_child();
+            } else {
+                curr_edge_idx = edges[curr_edge_idx].next;
+                if (curr_edge_idx != -1)
+                    curr = edges[curr_edge_idx];
+            }
             return *this;
         }
 
@@ -351,10 +668,30 @@ struct graph_t {
     orig_rev_edge_iterator begin_orig_rev_edges(node_t v) const { return orig_rev_edge_iterator(this, v); }
     orig_rev_edge_iterator end_orig_rev_edges() const { return orig_rev_edge_iterator(this, -1); }
 
-    // Iterator of the original outgoing edges in the graph (excluding edit-edges).
+    // Iterator of the original incoming edges in the graph (excluding edit-edges).
+    // The only incoming edge of a node in the implicit trie is from its parent. The incoming edges of a
+    // reference node from an FM-index or a lazy trie come last and have curr_edge_idx -2. They are
+    // computed on construction into a buffer of the thread, which the live iterators share as a stack,
+    // so iterators have to be destroyed in the reverse order of construction (as nested loops are).
     class orig_rev_edge_iterator {
         const graph_t *g;
-        int curr_edge_idx;
+        edge_idx_t curr_edge_idx;
+        bool in_trie;
+        std::vector<edge_t> *trie_parents;  // the thread's buffer, or nullptr
+        size_t parents_from, next_parent, parents_to;  // the range of this iterator in trie_parents
+        edge_t curr;
+
+        static std::vector<edge_t> *scratch() {
+            thread_local std::vector<edge_t> parents;
+            return &parents;
+        }
+
+        void next_trie_parent() {
+            if (curr_edge_idx == -1 && next_parent < parents_to) {
+                curr = (*trie_parents)[next_parent++];
+                curr_edge_idx = -2;
+            }
+        }
 
       public:
         using value_type = edge_t;
@@ -364,14 +701,52 @@ struct graph_t {
         using difference_type = void;
 
         orig_rev_edge_iterator(const graph_t *G, node_t _v)
-            : g(G), curr_edge_idx(_v != -1 ? G->V_rev[_v] : -1) {
+            : g(G), curr_edge_idx(-1), in_trie(false), trie_parents(nullptr), parents_from(0), next_parent(0), parents_to(0) {
+            if (_v == -1)
+                return;
+            if (G->node_in_implicit_trie(_v)) {
+                in_trie = true;
+                if (_v != 0) {
+                    node_t code = _v - G->trie_level_first[G->trie_node_depth(_v)];
+                    curr = edge_t::from_cost(_v, G->trie_parent(_v), nucls[code%4], JUMP);
+                    curr_edge_idx = 0;
+                }
+            } else {
+                curr_edge_idx = G->V_rev[_v];
+                if (curr_edge_idx != -1)
+                    curr = G->E_rev[curr_edge_idx];
+                if (G->fm_trie || G->lazy_trie) {
+                    trie_parents = scratch();
+                    parents_from = next_parent = trie_parents->size();
+                    G->implicit_trie_parents(_v, trie_parents);
+                    parents_to = trie_parents->size();
+                }
+                next_trie_parent();
+            }
+        }
+
+        orig_rev_edge_iterator(const orig_rev_edge_iterator &) = delete;
+        orig_rev_edge_iterator& operator=(const orig_rev_edge_iterator &) = delete;
+
+        ~orig_rev_edge_iterator() {
+            if (trie_parents) {
+                assert(trie_parents->size() == parents_to);
+                trie_parents->resize(parents_from);
+            }
         }
 
-        const reference operator*() const { return g->E_rev[curr_edge_idx]; }
-        pointer operator->() const { return (pointer)&(g->E_rev[curr_edge_idx]); }
+        const reference operator*() const { return curr; }
+        pointer operator->() const { return (pointer)&curr; }
 
         orig_rev_edge_iterator& operator++() {  // preincrement
-            curr_edge_idx = g->E_rev[curr_edge_idx].next;
+            if (in_trie || curr_edge_idx == -2) {
+                curr_edge_idx = -1;
+            } else {
+                curr_edge_idx = g->E_rev[curr_edge_idx].next;
+                if (curr_edge_idx != -1)
+                    curr = g->E_rev[curr_edge_idx];
+            }
+            next_trie_parent();
             return *this;
         }
 
@@ -390,18 +765,222 @@ struct graph_t {
         }
     };
 
+    // The outgoing original edges of a node sorted by label, so that the edges of each label are
+    // consecutive. Edges of E are used in place (see label_mask, which has to be built by
+    // group_edges_by_label after the last added edge); the children and exits of an implicit trie node
+    // and the edges located in an FM-index are built here, on the stack unless there are more than
+    // MAX_LOCAL. Only reference edges have subset labels.
+    class out_edges_t {
+        static const int MAX_LOCAL = 8;
+
+        const edge_t *first, *last;
+        uint8_t mask;              // as label_mask, or 0 if not known
+        edge_t local[MAX_LOCAL];
+        std::vector<edge_t> located;  // all edges, if more than MAX_LOCAL
+
+        // The edges from an FM-index leaf are in the order of their labels (see orig_edge_iterator).
+        void set_located(const graph_t *G, node_t v) {
+            int n = 0;
+            for (auto it=G->begin_orig_edges(v); it!=G->end_orig_edges(); ++it) {
+                if (n < MAX_LOCAL) {
+                    local[n++] = *it;
+                } else {
+                    if (located.empty())
+                        located.assign(local, local + n);
+                    located.push_back(*it);
+                }
+            }
+            first = located.empty() ? local : located.data();
+            last = located.empty() ? local + n : first + located.size();
+        }
+
+        // The children come in the order of their labels, followed by the exits (see trie_exit).
+        void set_children(const graph_t *G, node_t v) {
+            set_located(G, v);
+            if (!std::is_sorted(first, last, [](const edge_t &a, const edge_t &b) { return a.label < b.label; })) {
+                edge_t *edges = located.empty() ? local : located.data();
+                std::stable_sort(edges, edges + (last - first), [](const edge_t &a, const edge_t &b) {
+                    return a.label < b.label; });
+            }
+            bool unique = true;
+            for (const edge_t *e=first; e!=last; ++e) {
+                if ((mask >> nucl_index(e->label)) & 1)
+                    unique = false;
+                mask |= 1 << nucl_index(e->label);
+            }
+            if (unique)
+                mask |= LABELS_UNIQUE;
+        }
+
+      public:
+        out_edges_t(const graph_t *G, node_t v) : first(nullptr), last(nullptr), mask(0) {
+            if (v == -1)
+                return;
+            if (!G->node_in_implicit_trie(v)) {
+                assert(!G->label_mask.empty());
+                if (G->V[v] == -1)
+                    return;
+                mask = G->label_mask[v];
+                first = &G->E[G->V[v]];
+                if (mask & LABELS_UNIQUE) {
+                    last = first + __builtin_popcount(mask & 15);
+                } else {
+                    edge_idx_t idx = G->V[v];
+                    while (G->E[idx].next != -1)
+                        idx = G->E[idx].next;
+                    last = &G->E[idx] + 1;
+                }
+            } else if (G->lazy_trie) {
+                const lazy_trie_node_t *x = G->lazy_trie_expand(v);
+                if (x) {
+                    first = x->edges.data();
+                    last = first + x->edges.size();
+                }
+            } else if (v != 0 && v >= G->trie_level_first[G->trie_depth-1]) {
+                if (G->fm_trie) {
+                    set_located(G, v);
+                } else {
+                    auto range = G->trie_leaf_range(v);
+                    first = G->trie_leaf_edges.data() + range.first;
+                    last = G->trie_leaf_edges.data() + range.second;
+                }
+            } else {
+                set_children(G, v);
+            }
+        }
+
+        out_edges_t(const out_edges_t &) = delete;
+
+        const edge_t *begin() const { return first; }
+        const edge_t *end() const { return last; }
+
+        // Whether matching() may include edges not matching l (see label_matches).
+        bool filtered() const {
+            return mask & LABELS_SUBSETS;
+        }
+
+        // The edges labeled l: a single load if the labels are unique, a binary search otherwise. With
+        // subset labels, all edges.
+        std::pair<const edge_t*, const edge_t*> matching(label_t l) const {
+            if (filtered())
+                return std::make_pair(first, last);
+            if (mask & LABELS_UNIQUE) {
+                int k = nucl_index(l);
+                if (k == -1)
+                    return std::make_pair(last, last);
+                const edge_t *e = first + __builtin_popcount(mask & ((1 << k) - 1));
+                return std::make_pair(e, e + ((mask >> k) & 1));
+            }
+            edge_t key = edge_t::from_cost(-1, -1, l, ORIG);
+            return std::equal_range(first, last, key, [](const edge_t &a, const edge_t &b) {
+                return a.label < b.label; });
+        }
+    };
+
+    // Index of a nucleotide label in nucls, or -1.
+    static int nucl_index(label_t l) {
+        switch (l) {
+            case 'A': return 0;
+            case 'C': return 1;
+            case 'G': return 2;
+            case 'T': return 3;
+            default: return -1;
+        }
+    }
+
+    // The nucleotides (see nucl_mask) that an edge label spells in the trie. A walk of the trie does
+    // not continue through an unknown nucleotide (N), since a run of N would connect almost every trie
+    // leaf to each of its positions (see trie_exit).
+    static int trie_mask(label_t label) {
+        return label == 'N' ? 0 : nucl_mask(label);
+    }
+
+    // Whether a walk of the trie leaves it at an edge with this label: the trie node spelled so far
+    // connects to the end of the edge by one edge per nucleotide. So a run of N adds at most 4 edges per
+    // trie level, from the walks ending at its first N. The walks starting with an N are not indexed,
+    // so no alignment starts on an N.
+    static bool trie_exit(label_t label) {
+        return label == 'N';
+    }
+
+    // Sorts the outgoing edges of each node by label into consecutive slots of E and fills label_mask.
+    // Done once the trie is added, since adding an edge breaks the order.
+    void group_edges_by_label();
+
+    // Renumbers the reference nodes in breadth-first order and lays out their edges in that order (see
+    // graph.cpp). Done after adding the reverse complement and before the trie, which follows the
+    // order of the reference.
+    void reorder_nodes_bfs();
+
+    // Average difference between the ids of the ends of a reference edge: a proxy for how far apart in
+    // memory the nodes aligned one after another are.
+    double avg_edge_gap() const {
+        double sum = 0.0;
+        edge_idx_t cnt = 0;
+        for (node_t u=1; u<trie_first_node; u++)
+            for (edge_idx_t idx=V[u]; idx!=-1; idx=E[idx].next)
+                if (E[idx].type == ORIG && !node_in_trie(E[idx].to)) {
+                    sum += std::abs(double(E[idx].to) - double(u));
+                    ++cnt;
+                }
+        return cnt ? sum / cnt : 0.0;
+    }
+
     class all_matching_edge_iterator;
 
     all_matching_edge_iterator begin_all_edges(node_t v) const { return all_matching_edge_iterator(this, v, '!'); }
     all_matching_edge_iterator end_all_edges() const { return all_matching_edge_iterator(this, -1, '!'); }
 
-    all_matching_edge_iterator begin_all_matching_edges(node_t v, label_t l) const { return all_matching_edge_iterator(this, v, l); }
+    all_matching_edge_iterator begin_all_matching_edges(node_t v, label_t l) const {
+        assert(!label_mask.empty());  // see group_edges_by_label
+        return all_matching_edge_iterator(this, v, l);
+    }
     all_matching_edge_iterator end_all_matching_edges() const { return all_matching_edge_iterator(this, -1, '!'); }
 
-    // Iterator of all outgoing edges in the graph (incl. edit-edges).
+    // Iterator of all outgoing edges in the graph (incl. edit-edges) for reading the letter l: the
+    // matching edges (see label_matches), then a substitution (unless matching) and a deletion for each original edge,
+    // then an insertion. The edges are generated while iterating.
     class all_matching_edge_iterator {
-        std::vector<edge_t> edit_edges;
-        std::vector<edge_t>::const_iterator it;
+        enum phase_t { MATCHES, EDITS, INSERTION, DONE };
+
+        out_edges_t out;
+        std::pair<const edge_t*, const edge_t*> match;
+        const edge_t *e;       // the current original edge
+        bool deletion;         // the edit of e is a deletion (otherwise a substitution)
+        node_t v;
+        label_t l;
+        phase_t phase;
+        edge_t curr;
+
+        bool matches(const edge_t *x) const {
+            return out.filtered() ? label_matches(x->label, l) : x >= match.first && x < match.second;
+        }
+
+        // Sets curr to the first edge from the current position on.
+        void settle() {
+            if (phase == MATCHES) {
+                while (e != match.second && out.filtered() && !label_matches(e->label, l))
+                    ++e;
+                if (e != match.second) {
+                    curr = *e;
+                    return;
+                }
+                phase = EDITS;
+                e = out.begin();
+                deletion = false;
+            }
+            if (phase == EDITS) {
+                if (!deletion && e != out.end() && matches(e))
+                    deletion = true;  // no substitution of a matching edge
+                if (e != out.end()) {
+                    curr = deletion ? edge_t::from_cost(v, e->to, EPS, DEL) : edge_t::from_cost(v, e->to, l, SUBST);
+                    return;
+                }
+                phase = INSERTION;
+            }
+            if (phase == INSERTION)
+                curr = edge_t::from_cost(v, v, l, INS);
+        }
 
       public:
         using value_type = edge_t;
@@ -410,49 +989,37 @@ struct graph_t {
         using pointer = edge_t*;
         using difference_type = void;
 
-        all_matching_edge_iterator(const graph_t *G, node_t v, label_t l) {
-            if (l != '!') {
-                edit_edges.reserve(10);
-                for (int idx=G->V[v]; idx!=-1; idx=G->E[idx].next) {
-                    const edge_t &orig_e = G->E[idx];
-                    if (orig_e.label == l)
-                        // match
-                        edit_edges.push_back(orig_e);
-                }
-
-                for (int idx=G->V[v]; idx!=-1; idx=G->E[idx].next) {
-                    const edge_t &orig_e = G->E[idx];
-                    if (orig_e.label != l)
-                        // substitution
-                        edit_edges.push_back(edge_t::from_cost(v, orig_e.to, l, SUBST));
-
-                    // deletions
-                    edit_edges.push_back(edge_t::from_cost(v, orig_e.to, EPS, DEL));
-                }
-
-                // insertions
-                edit_edges.push_back(edge_t::from_cost(v, v, l, INS));
-            }
-
-            it = edit_edges.begin();
+        all_matching_edge_iterator(const graph_t *G, node_t _v, label_t _l)
+            : out(G, _l != '!' ? _v : -1), deletion(false), v(_v), l(_l), phase(_l != '!' ? MATCHES : DONE) {
+            if (phase == DONE)
+                return;
+            match = out.matching(l);
+            e = match.first;
+            settle();
         }
 
-        const reference operator*() const { return *it; }
-        pointer operator->() const { return (pointer)&(*it); }
+        all_matching_edge_iterator(const all_matching_edge_iterator &) = delete;
+
+        const reference operator*() const { return curr; }
+        pointer operator->() const { return (pointer)&curr; }
 
         all_matching_edge_iterator& operator++() {  // preincrement
-            ++it;
+            if (phase == MATCHES) {
+                ++e;
+            } else if (phase == EDITS) {
+                if (deletion)
+                    ++e;
+                deletion = !deletion;
+            } else {
+                phase = DONE;
+                return *this;
+            }
+            settle();
             return *this;
         }
 
-        const edge_t operator++(int) { // postincrement
-            edge_t tmp = *it;
-            ++it;
-            return tmp;
-        }
-
         friend bool operator==(all_matching_edge_iterator const& lhs, all_matching_edge_iterator const& rhs) {
-            return (lhs.it == rhs.it) || (lhs.it == lhs.edit_edges.end() && rhs.it == rhs.edit_edges.end());
+            return lhs.phase == DONE && rhs.phase == DONE;
         }
 
         friend bool operator!=(all_matching_edge_iterator const& lhs, all_matching_edge_iterator const& rhs) {
@@ -513,6 +1080,12 @@ class AStarHeuristic {
 
     virtual void before_every_alignment(const read_t *r) {}   // to be invoked once in the beginning of the alignment of each read
     virtual cost_t h(const state_t &st) const = 0;
+    virtual void h_batch(const state_t *st, size_t n, cost_t *hs) const {  // hs[k] = h(st[k]) for the successors of an expanded state
+        for (size_t k=0; k<n; k++)
+            hs[k] = h(st[k]);
+    }
+    virtual bool is_dynamic() const { return false; }          // whether h() may increase during the alignment of a read
+    virtual void on_expand(const state_t &st) {}               // to be invoked for every expanded state
     virtual void after_every_alignment(const AlignerTimers &t) {}
     virtual void print_params(std::ostream &out) const {}
     virtual void print_stats(std::ostream &out) const {}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+
+#include "argparse.h"
+#include "astar-prefix.h"
+#include "astar-seeds.h"
+#include "dijkstra.h"
+#include "graph.h"
+
+namespace astarix {
+
+// Creates the heuristic of the algorithm of the arguments. Before returning it, passes it to `bind`
+// as a pointer to its own type, so that an aligner can specialize its search for it (see
+// Aligner::set_heuristic).
+template<typename Bind>
+std::unique_ptr<AStarHeuristic> make_heuristic(const graph_t &G, const arguments &args, Bind bind) {
+    if (strcmp(args.algorithm, "astar-prefix") == 0) {
+        auto astar = std::make_unique<AStarPrefix>(G, args.costs, args.AStarLengthCap, args.AStarCostCap, args.AStarNodeEqivClasses);
+        bind(astar.get());
+        return astar;
+    }
+    if (strcmp(args.algorithm, "astar-seeds") == 0) {
+        auto astar = std::make_unique<AStarSeedsWithErrors>(G, args.costs, args.astar_seeds);
+        bind(astar.get());
+        return astar;
+    }
+    if (strcmp(args.algorithm, "dijkstra") == 0) {
+        auto astar = std::make_unique<DijkstraDummy>();
+        bind(astar.get());
+        return astar;
+    }
+    throw "Unknown algorithm.";
+}
+
+// The heuristic of the algorithm, not bound to an aligner.
+inline std::unique_ptr<AStarHeuristic> make_heuristic(const graph_t &G, const arguments &args) {
+    return make_heuristic(G, args, [](AStarHeuristic *) {});
+}
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "alloc-track.h"
+
+namespace astarix {
+
+// Histogram of non-negative integer values in logarithmic buckets (as in HDR histograms): values
+// below 2^SUB_BITS are counted exactly, and each larger power-of-two range is split into 2^SUB_BITS
+// buckets, so a percentile is reported within a relative error of 2^-SUB_BITS (about 3%).
+class LogHistogram {
+    static const int SUB_BITS = 5;
+    static const uint64_t SUB = uint64_t(1) << SUB_BITS;
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_;
+    uint64_t max_;
+    double sum_;
+
+    static size_t bucket(uint64_t v) {
+        if (v < SUB)
+            return v;
+        int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+        return (size_t(shift) + 1) * SUB + ((v >> shift) & (SUB - 1));
+    }
+
+    static uint64_t bucket_from(size_t b) {
+        if (b < SUB)
+            return b;
+        int shift = b / SUB - 1;
+        return (SUB + b % SUB) << shift;
+    }
+
+    static uint64_t bucket_to(size_t b) {  // inclusive
+        return bucket_from(b + 1) - 1;
+    }
+
+  public:
+    LogHistogram() : total_(0), max_(0), sum_(0.0) {}
+
+    void add(uint64_t v) {
+        size_t b = bucket(v);
+        if (b >= counts_.size())
+            counts_.resize(b + 1, 0);
+        ++counts_[b];
+        ++total_;
+        max_ = std::max(max_, v);
+        sum_ += v;
+    }
+
+    uint64_t count() const {
+        return total_;
+    }
+
+    uint64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return total_ ? sum_ / total_ : 0.0;
+    }
+
+    // The smallest value (up to the bucket precision) that at least a fraction p of the values do not exceed.
+    uint64_t percentile(double p) const {
+        uint64_t rank = std::max(uint64_t(1), uint64_t(p * total_ + 0.5));
+        uint64_t seen = 0;
+        for (size_t b=0; b<counts_.size(); b++) {
+            seen += counts_[b];
+            if (seen >= rank)
+                return std::min(bucket_to(b), max_);
+        }
+        return max_;
+    }
+
+    // One line per non-empty bucket: its value range (in the given unit), count and cumulative fraction.
+    void print_buckets(std::ostream &out, double unit) const {
+        uint64_t seen = 0;
+        for (size_t b=0; b<counts_.size(); b++)
+            if (counts_[b]) {
+                seen += counts_[b];
+                out << bucket_from(b) / unit << "\t" << bucket_to(b) / unit << "\t"
+                    << counts_[b] << "\t" << 1.0 * seen / total_ << std::endl;
+            }
+    }
+};
+
+// Per-read distributions of the search effort and the reads that took longest to align.
+struct ReadHistograms {
+    static const int SLOWEST_READS = 10;
+
+    struct read_time_t {
+        uint64_t ns;
+        std::string read;
+
+        bool operator<(const read_time_t &other) const {
+            return ns > other.ns;  // slowest first
+        }
+    };
+
+    LogHistogram wall_ns;       // alignment wall time
+    LogHistogram explored;      // explored states
+    LogHistogram popped;
+    LogHistogram astar_ns;      // time in the heuristic (0 if built with INSTRUMENT=0)
+    LogHistogram crumbs;        // states with crumbs (astar-seeds)
+    LogHistogram allocs;        // heap allocations while aligning (only with TRACK_ALLOCS)
+    std::vector<read_time_t> slowest;
+
+    void add(const std::string &read, uint64_t _wall_ns, uint64_t _explored, uint64_t _popped, uint64_t _astar_ns, uint64_t _crumbs, uint64_t _allocs) {
+        wall_ns.add(_wall_ns);
+        explored.add(_explored);
+        popped.add(_popped);
+        astar_ns.add(_astar_ns);
+        crumbs.add(_crumbs);
+        allocs.add(_allocs);
+
+        if ((int)slowest.size() < SLOWEST_READS || _wall_ns > slowest.back().ns) {
+            read_time_t t{_wall_ns, read};
+            slowest.insert(std::upper_bound(slowest.begin(), slowest.end(), t), t);
+            if ((int)slowest.size() > SLOWEST_READS)
+                slowest.pop_back();
+        }
+    }
+
+    void print(std::ostream &out) const {
+        struct metric_t { const char *name; const char *unit; double div; const LogHistogram *h; };
+        const metric_t metrics[] = {
+            { "wall_time", "ms", 1e6, &wall_ns },
+            { "explored_states", "states", 1.0, &explored },
+            { "popped", "states", 1.0, &popped },
+            { "astar_time", "ms", 1e6, &astar_ns },
+            { "crumbs", "states", 1.0, &crumbs },
+            { "allocations", "allocs", 1.0, &allocs },
+        };
+        const int n_metrics = TRACKING_ALLOCS ? 6 : 5;
+
+        out << "metric\tunit\treads\tmean\tp50\tp90\tp99\tp99.9\tmax" << std::endl;
+        for (int k=0; k<n_metrics; k++) {
+            const metric_t &m = metrics[k];
+            out << m.name << "\t" << m.unit << "\t" << m.h->count() << "\t" << m.h->mean() / m.div << "\t"
+                << m.h->percentile(0.5) / m.div << "\t" << m.h->percentile(0.9) / m.div << "\t"
+                << m.h->percentile(0.99) / m.div << "\t" << m.h->percentile(0.999) / m.div << "\t"
+                << m.h->max() / m.div << std::endl;
+        }
+
+        out << std::endl << "slowest reads" << std::endl;
+        out << "read\twall_time_ms" << std::endl;
+        for (const auto &t: slowest)
+            out << t.read << "\t" << t.ns / 1e6 << std::endl;
+
+        for (int k=0; k<n_metrics; k++) {
+            const metric_t &m = metrics[k];
+            out << std::endl << m.name << " histogram" << std::endl;
+            out << "from_" << m.unit << "\tto_" << m.unit << "\treads\tcumulative" << std::endl;
+            m.h->print_buckets(out, m.div);
+        }
+    }
+};
+
+}
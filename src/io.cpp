@@ -89,8 +89,8 @@ void read_graph(graph_t *G, std::string graph_file, std::string output_dir) {
         std::vector<astarix::seq_t> fastas = astarix::read_fasta(graph_file);
 		G->orig_nodes = G->orig_edges = 0;
         for (const auto &fasta: fastas) {
-            int source=G->add_node();
-            int sink=G->add_node();
+            node_t source=G->add_node();
+            node_t sink=G->add_node();
             G->add_seq(source, fasta.s, sink);
 			G->orig_nodes += fasta.s.size();
 			G->orig_edges += fasta.s.size()-1;
@@ -157,7 +157,7 @@ std::string get_read_matching(const edge_path_t &path, const read_t &r) {
     for (edge_t curr: path) {
         if (curr.label != EPS) {
             assert(last_read_i > 0 && last_read_i <= r.len);
-            read_match += (curr.label == r.s[last_read_i]) ? '-' : r.s[last_read_i];
+            read_match += label_matches(curr.label, r.s[last_read_i]) ? '-' : r.s[last_read_i];
             last_read_i++;
         } else {
             read_match += '.';
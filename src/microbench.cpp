@@ -0,0 +1,363 @@
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+
+#include "align.h"
+#include "heuristic-factory.h"
+#include "microbench.h"
+
+namespace astarix {
+
+static const char WORKLOAD_MAGIC[] = "astarix-workload-1";
+static const int REPEATS = 5;   // runs of each kernel; the fastest counts
+
+// Kernels are timed also when built with INSTRUMENT=0, which compiles the CycleTimers out.
+typedef BasicTimer<CycleClock> KernelTimer;
+
+size_t Workload::queries() const {
+    size_t n = 0;
+    for (const auto &rw: reads)
+        n += rw.queries.size();
+    return n;
+}
+
+size_t Workload::expansions() const {
+    size_t n = 0;
+    for (const auto &rw: reads)
+        n += rw.expansions.size();
+    return n;
+}
+
+template<typename T>
+static void write_pod(std::ofstream &f, const T &x) {
+    f.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+template<typename T>
+static void read_pod(std::ifstream &f, T *x) {
+    f.read(reinterpret_cast<char*>(x), sizeof(*x));
+}
+
+template<typename T>
+static void write_vector(std::ofstream &f, const std::vector<T> &v) {
+    write_pod(f, uint64_t(v.size()));
+    f.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template<typename T>
+static void read_vector(std::ifstream &f, std::vector<T> *v) {
+    uint64_t n = 0;
+    read_pod(f, &n);
+    if (!f)
+        return;
+    v->resize(n);
+    f.read(reinterpret_cast<char*>(v->data()), n * sizeof(T));
+}
+
+void Workload::save(const std::string &file) const {
+    std::ofstream f(file, std::ios::binary);
+    if (!f)
+        throw "Cannot write the workload file.";
+    f.write(WORKLOAD_MAGIC, sizeof(WORKLOAD_MAGIC));
+    write_pod(f, uint32_t(sizeof(state_t)));
+    write_vector(f, std::vector<char>(algorithm.begin(), algorithm.end()));
+    write_pod(f, int64_t(graph_nodes));
+    write_pod(f, uint64_t(reads.size()));
+    for (const auto &rw: reads) {
+        write_pod(f, int32_t(rw.read));
+        write_vector(f, rw.queries);
+        write_vector(f, rw.expansions);
+    }
+    if (!f)
+        throw "Cannot write the workload file.";
+}
+
+bool Workload::load(const std::string &file) {
+    std::ifstream f(file, std::ios::binary);
+    if (!f)
+        return false;
+
+    char magic[sizeof(WORKLOAD_MAGIC)];
+    f.read(magic, sizeof(magic));
+    if (!f || memcmp(magic, WORKLOAD_MAGIC, sizeof(magic)) != 0)
+        throw "Not a workload file of this version.";
+    uint32_t state_size = 0;
+    read_pod(f, &state_size);
+    if (state_size != sizeof(state_t))
+        throw "The workload was recorded with other node ids (see WIDE_IDS).";
+
+    std::vector<char> algo;
+    read_vector(f, &algo);
+    algorithm.assign(algo.begin(), algo.end());
+    int64_t nodes = 0;
+    read_pod(f, &nodes);
+    graph_nodes = nodes;
+    uint64_t n = 0;
+    read_pod(f, &n);
+    reads.resize(f ? n : 0);
+    for (auto &rw: reads) {
+        int32_t read = 0;
+        read_pod(f, &read);
+        rw.read = read;
+        read_vector(f, &rw.queries);
+        read_vector(f, &rw.expansions);
+    }
+    if (!f)
+        throw "The workload file is truncated.";
+    return true;
+}
+
+// Aligns all reads (without the prefix cache, whose frontier pushes are not expansions).
+static void record_workload(const graph_t &G, const std::vector<read_t> &R, const arguments &args, Workload *w) {
+    AlignParams params(args.costs, args.greedy_match, args.maxAlignmentCost);
+    Aligner aligner(G, params);
+    std::unique_ptr<AStarHeuristic> astar = make_heuristic(G, args);
+    WorkloadRecorder recorder(astar.get(), w);
+    aligner.set_heuristic<AStarHeuristic>(&recorder);
+
+    w->algorithm = args.algorithm;
+    w->graph_nodes = G.nodes();
+    for (int i=0; i<(int)R.size(); i++) {
+        recorder.start_read(i);
+        aligner.astar_before_every_alignment(&R[i]);
+        aligner.readmap(R[i], args.k_best_alignments);
+        aligner.astar_after_every_alignment();
+    }
+}
+
+struct kernel_run_t {
+    KernelTimer t;
+    uint64_t ops;
+    uint64_t checksum;      // of the results, to compare between versions
+    uint64_t differ;        // results different from the recorded ones
+
+    kernel_run_t() : ops(0), checksum(0), differ(0) {}
+};
+
+struct kernel_result_t {
+    std::string name;
+    const char *unit;
+    kernel_run_t run;
+};
+
+// Runs the kernel REPEATS times and keeps the fastest run.
+template<typename F>
+static kernel_result_t measure(const char *name, const char *unit, F kernel) {
+    kernel_result_t best{name, unit, kernel_run_t()};
+    for (int rep=0; rep<REPEATS; rep++) {
+        kernel_run_t run;
+        kernel(&run);
+        if (rep == 0 || run.t.get_sec() < best.run.t.get_sec())
+            best.run = run;
+    }
+    return best;
+}
+
+// The recorded heuristic queries one by one, after preparing each read as the aligner does.
+template<typename H>
+static void replay_h(H *astar, const Workload &w, const std::vector<read_t> &R, kernel_run_t *run) {
+    for (const auto &rw: w.reads) {
+        astar->before_every_alignment(&R[rw.read]);
+        run->t.start();
+        for (const auto &q: rw.queries) {
+            cost_t h = astar->h(q.st);
+            run->checksum += h;
+            run->differ += h != q.h;
+        }
+        run->t.stop();
+        astar->after_every_alignment(AlignerTimers());
+        run->ops += rw.queries.size();
+    }
+}
+
+// The recorded batches of successors of the expanded states.
+template<typename H>
+static void replay_h_batch(H *astar, const Workload &w, const std::vector<read_t> &R, kernel_run_t *run) {
+    std::vector<state_t> st;
+    std::vector<cost_t> hs;
+    for (const auto &rw: w.reads) {
+        st.clear();
+        for (const auto &q: rw.queries)
+            st.push_back(q.st);
+        hs.assign(st.size(), 0);
+
+        astar->before_every_alignment(&R[rw.read]);
+        run->t.start();
+        for (const auto &ex: rw.expansions)
+            if (ex.pushed)
+                astar->h_batch(&st[ex.first_query], ex.pushed, &hs[ex.first_query]);
+        run->t.stop();
+        astar->after_every_alignment(AlignerTimers());
+
+        for (const auto &ex: rw.expansions)
+            for (int k=ex.first_query; k<ex.first_query+ex.pushed; k++) {
+                run->checksum += hs[k];
+                run->differ += hs[k] != rw.queries[k].h;
+                ++run->ops;
+            }
+    }
+}
+
+// The crumbs of each seed match put anew, as if the crumb cache missed.
+static void replay_crumbs(AStarSeedsWithErrors *seeds, const Workload &w, const std::vector<read_t> &R, kernel_run_t *run) {
+    for (const auto &rw: w.reads) {
+        seeds->before_every_alignment(&R[rw.read]);
+        run->t.start();
+        for (int m=0; m<seeds->matches(); m++)
+            run->checksum += seeds->put_match_crumbs(m);
+        run->t.stop();
+        run->ops += seeds->matches();
+        seeds->after_every_alignment(AlignerTimers());
+    }
+}
+
+// The edges matching the next read letter from each expanded state.
+static void replay_matching_edges(const graph_t &G, const Workload &w, const std::vector<read_t> &R, kernel_run_t *run) {
+    for (const auto &rw: w.reads) {
+        const read_t &r = R[rw.read];
+        run->t.start();
+        for (const auto &ex: rw.expansions)
+            for (auto it=G.begin_all_matching_edges(ex.expanded.v, r.s[ex.expanded.i]); it!=G.end_all_matching_edges(); ++it)
+                run->checksum += (*it).to;
+        run->t.stop();
+        run->ops += rw.expansions.size();
+    }
+}
+
+// The greedy matching from each popped state, with the successors of the previous expansions in the
+// table of optimal states as in the aligner.
+static void replay_proceed_identity(const graph_t &G, const AlignParams &params, const Workload &w, const std::vector<read_t> &R, kernel_run_t *run) {
+    Aligner aligner(G, params);
+    DijkstraDummy dijkstra;
+    for (const auto &rw: w.reads) {
+        const read_t &r = R[rw.read];
+        aligner.p.clear();
+        aligner.pe.clear();
+        for (const auto &ex: rw.expansions) {
+            run->t.start();
+            state_t st = aligner.proceed_identity(&dijkstra, aligner.p, aligner.pe, ex.popped, r);
+            run->t.stop();
+            run->checksum += st.i;
+            run->differ += st.i != ex.expanded.i || st.v != ex.expanded.v;
+            for (int k=ex.first_query; k<ex.first_query+ex.pushed; k++)
+                aligner.p[std::make_pair(rw.queries[k].st.i, rw.queries[k].st.v)].optimize(rw.queries[k].st);
+        }
+        run->ops += rw.expansions.size();
+    }
+}
+
+// A pop for each expansion and a push for each of its successors, in a new queue for each read.
+static void replay_queue(const Workload &w, kernel_run_t *run) {
+    for (const auto &rw: w.reads) {
+        run->t.start();
+        queue_t Q;
+        Q.push(score_state_t(0, state_t(0, 0, 0, -1, -1)));
+        for (const auto &ex: rw.expansions) {
+            if (!Q.empty()) {
+                run->checksum += Q.top().first;
+                Q.pop();
+            }
+            for (int k=ex.first_query; k<ex.first_query+ex.pushed; k++) {
+                const auto &q = rw.queries[k];
+                Q.push(score_state_t(q.st.cost + q.h, q.st));
+            }
+        }
+        run->t.stop();
+        run->ops += 1 + rw.expansions.size();
+        for (const auto &ex: rw.expansions)
+            run->ops += ex.pushed;
+    }
+}
+
+// For each expansion: the expanded state, and for each successor a lookup of the expanded state and
+// an update of the successor, as in Aligner::try_edge.
+static void replay_state_table(const Workload &w, kernel_run_t *run) {
+    decltype(Aligner::p) p;
+    for (const auto &rw: w.reads) {
+        p.clear();
+        run->t.start();
+        for (const auto &ex: rw.expansions) {
+            p[std::make_pair(ex.expanded.i, ex.expanded.v)].optimize(ex.expanded);
+            for (int k=ex.first_query; k<ex.first_query+ex.pushed; k++) {
+                const state_t &next = rw.queries[k].st;
+                run->checksum += p.find(std::make_pair(ex.expanded.i, ex.expanded.v))->second.cost;
+                run->checksum += p[std::make_pair(next.i, next.v)].optimize(next);
+            }
+        }
+        run->t.stop();
+        for (const auto &ex: rw.expansions)
+            run->ops += 1 + 2*ex.pushed;
+    }
+}
+
+void run_microbenchmarks(const graph_t &G, const std::vector<read_t> &R, const arguments &args, std::ostream &out) {
+    if (args.output_dir.empty())
+        throw "microbench needs an output directory for the workload.";
+    std::string workload_file = args.output_dir + "/workload.bin";
+
+    Workload w;
+    if (w.load(workload_file)) {
+        out << "Loaded the workload from " << workload_file << ": " << std::flush;
+        if (w.algorithm != args.algorithm)
+            throw "The workload was recorded with another algorithm.";
+        if (w.graph_nodes != G.nodes())
+            throw "The workload was recorded on another graph.";
+        for (const auto &rw: w.reads)
+            if (rw.read >= (int)R.size())
+                throw "The workload was recorded for other reads.";
+    } else {
+        out << "Recording the workload into " << workload_file << "... " << std::flush;
+        PhaseTimer t;
+        t.start();
+        record_workload(G, R, args, &w);
+        w.save(workload_file);
+        t.stop();
+        out << "done in " << t.get_sec() << "s: ";
+    }
+    out << w.reads.size() << " reads, " << w.queries() << " heuristic queries, " << w.expansions() << " expansions." << std::endl;
+
+    AlignParams params(args.costs, true, args.maxAlignmentCost);
+    std::vector<kernel_result_t> results;
+
+    std::string algo = args.algorithm;
+    if (algo == "astar-seeds") {
+        AStarSeedsWithErrors seeds(G, args.costs, args.astar_seeds);
+        results.push_back(measure("seeds_put_crumbs", "matches", [&](kernel_run_t *run) { replay_crumbs(&seeds, w, R, run); }));
+        results.push_back(measure("seeds_h", "queries", [&](kernel_run_t *run) { replay_h(&seeds, w, R, run); }));
+        results.push_back(measure("seeds_h_batch", "queries", [&](kernel_run_t *run) { replay_h_batch(&seeds, w, R, run); }));
+    } else if (algo == "astar-prefix") {
+        // Cold: a new heuristic for each run, so that the memo misses are computed by lazy_star_value.
+        results.push_back(measure("prefix_h_cold", "queries", [&](kernel_run_t *run) {
+            AStarPrefix prefix(G, args.costs, args.AStarLengthCap, args.AStarCostCap, args.AStarNodeEqivClasses);
+            replay_h(&prefix, w, R, run);
+        }));
+        AStarPrefix prefix(G, args.costs, args.AStarLengthCap, args.AStarCostCap, args.AStarNodeEqivClasses);
+        kernel_run_t warmup;
+        replay_h(&prefix, w, R, &warmup);
+        results.push_back(measure("prefix_h_warm", "queries", [&](kernel_run_t *run) { replay_h(&prefix, w, R, run); }));
+        results.push_back(measure("prefix_h_batch_warm", "queries", [&](kernel_run_t *run) { replay_h_batch(&prefix, w, R, run); }));
+    }
+    results.push_back(measure("matching_edges", "expansions", [&](kernel_run_t *run) { replay_matching_edges(G, w, R, run); }));
+    results.push_back(measure("proceed_identity", "expansions", [&](kernel_run_t *run) { replay_proceed_identity(G, params, w, R, run); }));
+    results.push_back(measure("queue_push_pop", "ops", [&](kernel_run_t *run) { replay_queue(w, run); }));
+    results.push_back(measure("state_table", "ops", [&](kernel_run_t *run) { replay_state_table(w, run); }));
+
+    std::ofstream tsv(args.output_dir + "/microbench.tsv");
+    tsv << "kernel\tops\tunit\tsec\tns_per_op\tchecksum\tdiffer" << std::endl;
+
+    out << std::endl;
+    out << " == Microbenchmarks (fastest of " << REPEATS << " runs) ==" << std::endl;
+    for (const auto &k: results) {
+        double sec = k.run.t.get_sec();
+        double ns = k.run.ops ? 1e9 * sec / k.run.ops : 0.0;
+        out << std::setw(27) << k.name << ": " << ns << " ns x " << k.run.ops << " " << k.unit << " = " << sec << "s";
+        if (k.run.differ)
+            out << " (" << k.run.differ << " differ from the recorded)";
+        out << std::endl;
+        tsv << k.name << "\t" << k.run.ops << "\t" << k.unit << "\t" << sec << "\t" << ns << "\t"
+            << k.run.checksum << "\t" << k.run.differ << std::endl;
+    }
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "argparse.h"
+#include "graph.h"
+#include "utils.h"
+
+namespace astarix {
+
+// The heuristic queries and the expanded states of aligning a set of reads, recorded once and
+// replayed by the microbenchmarks of the alignment kernels (see run_microbenchmarks).
+struct Workload {
+    struct query_t {
+        state_t st;
+        cost_t h;                   // as recorded
+    };
+
+    // A state popped from the queue, greedily matched up to `expanded`, whose improved successors
+    // are the `pushed` queries from `first_query` on (-1 if none).
+    struct expansion_t {
+        state_t popped, expanded;
+        int first_query, pushed;
+    };
+
+    struct read_workload_t {
+        int read;                   // index in the reads
+        std::vector<query_t> queries;
+        std::vector<expansion_t> expansions;
+    };
+
+    std::string algorithm;
+    node_t graph_nodes;             // for checking that it is replayed on the same graph
+    std::vector<read_workload_t> reads;
+
+    size_t queries() const;
+    size_t expansions() const;
+
+    void save(const std::string &file) const;
+    bool load(const std::string &file);     // false if there is no such file
+};
+
+// Passes all calls to the heuristic of the aligner and records them into the workload.
+class WorkloadRecorder final: public AStarHeuristic {
+    AStarHeuristic *astar_;
+    Workload *w_;
+
+  public:
+    WorkloadRecorder(AStarHeuristic *_astar, Workload *_w)
+        : astar_(_astar), w_(_w) {}
+
+    void before_every_alignment(const read_t *r) {
+        astar_->before_every_alignment(r);
+    }
+
+    void start_read(int read) {
+        w_->reads.push_back(Workload::read_workload_t{read, {}, {}});
+    }
+
+    cost_t h(const state_t &st) const {
+        cost_t h = astar_->h(st);
+        w_->reads.back().queries.push_back(Workload::query_t{st, h});
+        return h;
+    }
+
+    void h_batch(const state_t *st, size_t n, cost_t *hs) const {
+        astar_->h_batch(st, n, hs);
+        auto &rw = w_->reads.back();
+        if (!rw.expansions.empty()) {
+            rw.expansions.back().first_query = rw.queries.size();
+            rw.expansions.back().pushed = n;
+        }
+        for (size_t k=0; k<n; k++)
+            rw.queries.push_back(Workload::query_t{st[k], hs[k]});
+    }
+
+    bool is_dynamic() const {
+        return astar_->is_dynamic();
+    }
+
+    // A greedily matched state follows the expanded one before its successors are evaluated; any
+    // other expanded state was popped.
+    void on_expand(const state_t &st) {
+        astar_->on_expand(st);
+        auto &ex = w_->reads.back().expansions;
+        if (!ex.empty() && ex.back().first_query == -1 && st.prev_i == ex.back().expanded.i
+                && st.prev_v == ex.back().expanded.v)
+            ex.back().expanded = st;
+        else
+            ex.push_back(Workload::expansion_t{st, st, -1, 0});
+    }
+
+    void after_every_alignment(const AlignerTimers &t) {
+        astar_->after_every_alignment(t);
+    }
+};
+
+// Records the workload of aligning the reads with the algorithm of the arguments into
+// OUTDIR/workload.bin (or loads it from there if it exists), replays it through the alignment
+// kernels and prints their time per operation (also into OUTDIR/microbench.tsv).
+void run_microbenchmarks(const graph_t &G, const std::vector<read_t> &R, const arguments &args, std::ostream &out);
+
+}
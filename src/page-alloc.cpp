@@ -0,0 +1,169 @@
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <mutex>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <plog/Log.h>
+
+#include "alloc-track.h"
+#include "page-alloc.h"
+
+namespace astarix {
+
+static huge_pages_t huge_pages = HUGE_PAGES_OFF;
+static int numa_node = -1;
+
+static std::atomic<size_t> mapped_bytes(0), explicit_bytes(0), unbound_bytes(0);
+static std::mutex maps_mutex;
+static std::unordered_set<void*> explicit_maps;  // mapped with MAP_HUGETLB
+static std::unordered_set<void*> unbound_maps;
+static std::unordered_map<void*, alloc_tag_t> tracked_maps;  // with TRACK_ALLOCS
+
+static size_t round_up(size_t x, size_t to) {
+    return (x + to - 1) / to * to;
+}
+
+void set_page_placement(huge_pages_t _huge_pages, int _numa_node) {
+    if (mapped_bytes.load() > 0)
+        throw "The page placement is set after mapping arrays.";
+    huge_pages = _huge_pages;
+    numa_node = _numa_node;
+}
+
+huge_pages_t page_placement_huge_pages() {
+    return huge_pages;
+}
+
+int page_placement_numa_node() {
+    return numa_node;
+}
+
+bool maps_pages(size_t bytes) {
+    return (huge_pages != HUGE_PAGES_OFF || numa_node != -1) && bytes >= HUGE_PAGE_BYTES;
+}
+
+// Binds the (not yet touched) pages to the NUMA node; the mbind system call spares linking libnuma.
+static bool bind_to_numa_node(void *p, size_t len) {
+    unsigned long mask[16] = {};
+    if (numa_node >= int(sizeof(mask) * 8))
+        return false;
+    mask[numa_node / (8*sizeof(mask[0]))] = 1UL << (numa_node % (8*sizeof(mask[0])));
+    return syscall(SYS_mbind, p, len, MPOL_BIND, mask, sizeof(mask) * 8, 0) == 0;
+}
+
+// Explicit huge pages come from the pool reserved in /proc/sys/vm/nr_hugepages; if it runs out, the
+// array falls back to transparent huge pages. Otherwise the mapping is aligned to a huge page so
+// that the kernel can back all of it by huge pages.
+void *map_pages(size_t bytes) {
+    size_t len = round_up(bytes, HUGE_PAGE_BYTES);
+    void *p = MAP_FAILED;
+    bool is_explicit = false;
+    if (huge_pages == HUGE_PAGES_EXPLICIT) {
+        p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        is_explicit = p != MAP_FAILED;
+    }
+    if (p == MAP_FAILED) {
+        size_t over = len + HUGE_PAGE_BYTES;
+        char *q = static_cast<char*>(mmap(nullptr, over, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (q == MAP_FAILED)
+            throw std::bad_alloc();
+        char *start = q + (round_up(reinterpret_cast<uintptr_t>(q), HUGE_PAGE_BYTES) - reinterpret_cast<uintptr_t>(q));
+        if (start > q)
+            munmap(q, start - q);
+        if (q + over > start + len)
+            munmap(start + len, q + over - (start + len));
+        p = start;
+        if (huge_pages != HUGE_PAGES_OFF)
+            madvise(p, len, MADV_HUGEPAGE);
+    }
+    bool unbound = numa_node != -1 && !bind_to_numa_node(p, len);
+
+    mapped_bytes += len;
+    if (is_explicit || unbound || TRACKING_ALLOCS) {
+        std::lock_guard<std::mutex> lock(maps_mutex);
+        if (TRACKING_ALLOCS)
+            tracked_maps[p] = track_alloc(len);
+        if (is_explicit) {
+            explicit_maps.insert(p);
+            explicit_bytes += len;
+        }
+        if (unbound) {
+            if (unbound_maps.empty()) {
+                LOG_WARNING << "Cannot bind graph arrays to NUMA node " << numa_node << ".";
+            }
+            unbound_maps.insert(p);
+            unbound_bytes += len;
+        }
+    }
+    return p;
+}
+
+void unmap_pages(void *p, size_t bytes) {
+    size_t len = round_up(bytes, HUGE_PAGE_BYTES);
+    munmap(p, len);
+    mapped_bytes -= len;
+    std::lock_guard<std::mutex> lock(maps_mutex);
+    if (explicit_maps.erase(p))
+        explicit_bytes -= len;
+    if (unbound_maps.erase(p))
+        unbound_bytes -= len;
+    auto it = tracked_maps.find(p);
+    if (it != tracked_maps.end()) {
+        track_free(len, it->second);
+        tracked_maps.erase(it);
+    }
+}
+
+size_t mapped_page_bytes() {
+    return mapped_bytes;
+}
+
+size_t explicit_huge_page_bytes() {
+    return explicit_bytes;
+}
+
+size_t unbound_page_bytes() {
+    return unbound_bytes;
+}
+
+size_t anon_huge_page_bytes() {
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string key;
+    size_t kb;
+    while (in >> key)
+        if (key == "AnonHugePages:" && in >> kb)
+            return kb * 1024;
+    return 0;
+}
+
+// The CPUs of a node are listed as ranges, e.g. "0-3,8-11".
+bool pin_to_numa_node(int node) {
+    std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!(in >> list))
+        return false;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        size_t dash = range.find('-');
+        int from = std::stoi(range.substr(0, dash));
+        int to = dash == std::string::npos ? from : std::stoi(range.substr(dash+1));
+        for (int cpu=from; cpu<=to && cpu<CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &cpus);
+    }
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace astarix {
+
+// Placement of the large graph arrays (see graph_vector), which the aligner reads at random: on huge
+// pages to save TLB misses, and on the NUMA node of the aligning thread to avoid remote accesses.
+enum huge_pages_t { HUGE_PAGES_OFF=0, HUGE_PAGES_TRANSPARENT=1, HUGE_PAGES_EXPLICIT=2 };
+
+const size_t HUGE_PAGE_BYTES = size_t(2) << 20;
+
+// Set before building the graph: the allocator decides how to free an array by its size, so the
+// placement may not change while arrays of HUGE_PAGE_BYTES or more are allocated.
+void set_page_placement(huge_pages_t huge_pages, int numa_node);
+huge_pages_t page_placement_huge_pages();
+int page_placement_numa_node();
+
+// Arrays of at least HUGE_PAGE_BYTES are mapped aligned to huge pages when a placement is set.
+bool maps_pages(size_t bytes);
+void *map_pages(size_t bytes);
+void unmap_pages(void *p, size_t bytes);
+
+size_t mapped_page_bytes();         // in the live mapped arrays
+size_t explicit_huge_page_bytes();  // of them on explicit huge pages (MAP_HUGETLB)
+size_t unbound_page_bytes();        // of them that could not be bound to the NUMA node
+size_t anon_huge_page_bytes();      // transparent huge pages used by the process (AnonHugePages)
+
+// Pins the calling thread (and the threads it starts) to the CPUs of a NUMA node.
+bool pin_to_numa_node(int node);
+
+template<typename T>
+class page_allocator {
+  public:
+    typedef T value_type;
+
+    page_allocator() noexcept {}
+    template<typename U> page_allocator(const page_allocator<U> &) noexcept {}
+
+    T *allocate(size_t n) {
+        size_t bytes = n * sizeof(T);
+        if (maps_pages(bytes))
+            return static_cast<T*>(map_pages(bytes));
+        return static_cast<T*>(::operator new(bytes));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        size_t bytes = n * sizeof(T);
+        if (maps_pages(bytes))
+            unmap_pages(p, bytes);
+        else
+            ::operator delete(p);
+    }
+
+    template<typename U> bool operator==(const page_allocator<U> &) const noexcept { return true; }
+    template<typename U> bool operator!=(const page_allocator<U> &) const noexcept { return false; }
+};
+
+template<typename T>
+using graph_vector = std::vector<T, page_allocator<T>>;
+
+}
@@ -0,0 +1,151 @@
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <plog/Log.h>
+
+#include "perf-counters.h"
+
+namespace astarix {
+
+const char *perf_event_names[PERF_EVENTS] = { "cycles", "instructions", "llc_misses", "dtlb_misses", "branch_misses" };
+
+static void event_attr(int e, perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    switch (e) {
+        case PERF_CYCLES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_LLC_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PERF_DTLB_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case PERF_BRANCH_MISSES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+    }
+}
+
+// The events form one group under the first available one, so that they are multiplexed together
+// and their ratios (e.g. instructions per cycle) hold even if the group is counted only part of the
+// time. An event that cannot be opened is left out instead of failing the group.
+PerfCounters::PerfCounters(bool inherit) : leader_(-1), members_(0) {
+    for (int e=0; e<PERF_EVENTS; e++) {
+        perf_event_attr attr;
+        event_attr(e, &attr);
+        attr.inherit = inherit;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd_[e] = syscall(SYS_perf_event_open, &attr, 0, -1, leader_ == -1 ? -1 : fd_[leader_], 0);
+        page_[e] = nullptr;
+        if (fd_[e] == -1) {
+            LOG_WARNING << "Performance counter " << perf_event_names[e] << " is unavailable: " << strerror(errno);
+            continue;
+        }
+        if (leader_ == -1)
+            leader_ = e;
+        member_[members_++] = e;
+        if (inherit)
+            continue;  // rdpmc reads only the calling thread
+        void *p = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd_[e], 0);
+        if (p != MAP_FAILED)
+            page_[e] = static_cast<perf_event_mmap_page*>(p);
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int e=0; e<PERF_EVENTS; e++) {
+        if (page_[e])
+            munmap(page_[e], sysconf(_SC_PAGESIZE));
+        if (fd_[e] != -1)
+            close(fd_[e]);
+    }
+}
+
+// Reads the counter in user space as documented in perf_event_open(2): the kernel publishes the
+// hardware counter index and an offset, and the sequence lock tells whether they changed meanwhile.
+// The enabled and running times are extrapolated from the time stamp counter.
+static bool read_pmc(const perf_event_mmap_page *pc, uint64_t *count, uint64_t *enabled, uint64_t *running) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t seq;
+    uint64_t n, en, run;
+    do {
+        seq = pc->lock;
+        __sync_synchronize();
+        if (!pc->cap_user_rdpmc || !pc->cap_user_time || pc->index == 0)
+            return false;
+        en = pc->time_enabled;
+        run = pc->time_running;
+        uint32_t lo, hi;
+        asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        uint64_t cyc = (uint64_t(hi) << 32) | lo;
+        uint64_t quot = cyc >> pc->time_shift;
+        uint64_t rem = cyc & ((uint64_t(1) << pc->time_shift) - 1);
+        uint64_t delta = pc->time_offset + quot * pc->time_mult + ((rem * pc->time_mult) >> pc->time_shift);
+        en += delta;
+        run += delta;  // counting, since the index is set
+        asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(pc->index - 1));
+        int64_t pmc = (int64_t(hi) << 32) | lo;
+        pmc <<= 64 - pc->pmc_width;
+        pmc >>= 64 - pc->pmc_width;  // sign-extend
+        n = pc->offset + pmc;
+        __sync_synchronize();
+    } while (pc->lock != seq);
+    *count = n;
+    *enabled = en;
+    *running = run;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// The times of the group are those of the leader, with which the other events are scheduled.
+bool PerfCounters::read_by_rdpmc(perf_counts_t *c) const {
+    if (members_ == 0)
+        return false;
+    for (int k=0; k<members_; k++) {
+        int e = member_[k];
+        uint64_t en, run;
+        if (!page_[e] || !read_pmc(page_[e], &c->n[e], &en, &run))
+            return false;
+        if (e == leader_) {
+            c->enabled = en;
+            c->running = run;
+        }
+    }
+    return true;
+}
+
+// One system call reads the group: the number of events, the enabled and running times and the
+// counts in the order the events were opened.
+perf_counts_t PerfCounters::read() const {
+    perf_counts_t c;
+    if (members_ == 0 || read_by_rdpmc(&c))
+        return c;
+    uint64_t buf[3 + PERF_EVENTS];
+    ssize_t bytes = ::read(fd_[leader_], buf, sizeof(buf));
+    if (bytes < ssize_t(3 * sizeof(uint64_t)) || buf[0] != uint64_t(members_))
+        return perf_counts_t();
+    c.enabled = buf[1];
+    c.running = buf[2];
+    for (int k=0; k<members_; k++)
+        c.n[member_[k]] = buf[3 + k];
+    return c;
+}
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <string>
+
+struct perf_event_mmap_page;
+
+namespace astarix {
+
+// Hardware event counts (user space only) from perf_event_open, opened as one group so that they are
+// scheduled together. The events that the CPU or the kernel does not provide (e.g. in a virtual
+// machine or with perf_event_paranoid > 2) are unavailable and reported as NA.
+enum perf_event_t { PERF_CYCLES=0, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES, PERF_EVENTS };
+
+extern const char *perf_event_names[PERF_EVENTS];  // e.g. "llc_misses"
+
+struct perf_counts_t {
+    uint64_t n[PERF_EVENTS];
+    uint64_t enabled, running;  // ns; the group runs for less than it is enabled if the PMU is multiplexed
+
+    perf_counts_t() : n(), enabled(0), running(0) {}
+
+    perf_counts_t& operator+=(const perf_counts_t &b) {
+        for (int e=0; e<PERF_EVENTS; e++)
+            n[e] += b.n[e];
+        enabled += b.enabled;
+        running += b.running;
+        return *this;
+    }
+
+    perf_counts_t operator-(const perf_counts_t &b) const {
+        perf_counts_t d;
+        for (int e=0; e<PERF_EVENTS; e++)
+            d.n[e] = n[e] - b.n[e];
+        d.enabled = enabled - b.enabled;
+        d.running = running - b.running;
+        return d;
+    }
+
+    // The count extrapolated to the whole enabled time; -1 if the group never ran.
+    double scaled(int e) const {
+        return running ? double(n[e]) * enabled / running : -1.0;
+    }
+};
+
+class PerfCounters {
+    int fd_[PERF_EVENTS];
+    int leader_;                                // the first available event
+    int members_, member_[PERF_EVENTS];         // the available events in the order of a group read
+    perf_event_mmap_page *page_[PERF_EVENTS];  // for reading by rdpmc without a system call, if allowed
+
+    bool read_by_rdpmc(perf_counts_t *c) const;
+
+  public:
+    // With `inherit`, also counts the threads that the caller spawns afterwards (e.g. building the
+    // trie), read by a system call. Otherwise counts only the calling thread, read by rdpmc if allowed.
+    explicit PerfCounters(bool inherit);
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters& operator=(const PerfCounters &) = delete;
+
+    bool available(int e) const {
+        return fd_[e] != -1;
+    }
+
+    // Whether reading needs no system call, which pays off for measuring every expanded state.
+    bool rdpmc() const {
+        perf_counts_t c;
+        return read_by_rdpmc(&c);
+    }
+
+    // The counts since opening.
+    perf_counts_t read() const;
+};
+
+// Accumulates the counts between start() and stop(), like Timer. Does nothing without counters, and
+// the StatePerfMeasurers of every expanded state are compiled out with NO_INSTRUMENT (see CycleTimer).
+template<bool enabled = true>
+class BasicPerfMeasurer {
+    const PerfCounters *pc_;
+    perf_counts_t start_, accum_;
+    bool running;
+
+  public:
+    BasicPerfMeasurer() : pc_(nullptr), running(false) {}
+
+    void set_counters(const PerfCounters *pc) {
+        pc_ = pc;
+    }
+
+    void start() {
+        assert(!running);
+        running = true;
+        if (enabled && pc_)
+            start_ = pc_->read();
+    }
+
+    void stop() {
+        if (enabled && pc_)
+            accum_ += pc_->read() - start_;
+        assert(running);
+        running = false;
+    }
+
+    const perf_counts_t& get() const {
+        assert(!running);
+        return accum_;
+    }
+
+    // Adds <prefix>_<event> for each event, scaled to the enabled time, and <prefix>_perf_running
+    // with the fraction of that time the events were counted.
+    template<typename Dict>
+    void extract_to_dict(const std::string &prefix, Dict *dict) const {
+        bool counted = enabled && pc_ && accum_.running > 0;
+        for (int e=0; e<PERF_EVENTS; e++)
+            (*dict)[prefix + "_" + perf_event_names[e]] = counted && pc_->available(e) ? std::to_string(uint64_t(accum_.scaled(e) + 0.5)) : "NA";
+        (*dict)[prefix + "_perf_running"] = counted ? std::to_string(double(accum_.running) / accum_.enabled) : "NA";
+    }
+};
+
+typedef BasicPerfMeasurer<> PerfMeasurer;
+#ifdef NO_INSTRUMENT
+typedef BasicPerfMeasurer<false> StatePerfMeasurer;
+#else
+typedef BasicPerfMeasurer<> StatePerfMeasurer;
+#endif
+
+// The alignment split into evaluating the heuristic, expanding states (relaxing their edges and the
+// greedy match) and the queue operations. Only worth measuring with counters read by rdpmc.
+struct AlignerPerf {
+    StatePerfMeasurer astar, expand, queue;
+
+    void set_counters(const PerfCounters *pc) {
+        astar.set_counters(pc);
+        expand.set_counters(pc);
+        queue.set_counters(pc);
+    }
+};
+
+}
@@ -1,84 +1,388 @@
 #include <algorithm>
+#include <climits>
+#include <cmath>
 #include <iostream>
 #include <map>
+#include <thread>
 #include <vector>
 #include <fstream>
 #include <string>
 
 #include "graph.h"
 #include "io.h"
+#include "trie.h"
 
 using namespace std;
 using namespace astarix;
 
-typedef vector<pair<int, pair<int, char>>> EdgeList;
+// Calls f(k) for each nucleotide nucls[k] that an edge label spells in the trie: several for a subset
+// of nucleotides, none for N (see graph_t::trie_mask).
+template<typename F>
+void for_each_nucl(label_t label, F f) {
+    int mask = graph_t::trie_mask(label);
+    for (int k=0; k<4; k++)
+        if ((mask >> k) & 1)
+            f(k);
+}
+
+// Calls on_leaf_edge(trie_v, e) with the edges by which the trie node trie_v exits at the reference
+// edge u->e.to (see graph_t::trie_exit). Returns false if the edge does not exit the trie.
+template<typename F>
+bool exit_trie(label_t label, node_t trie_v, node_t u, node_t to, F on_leaf_edge) {
+    if (!graph_t::trie_exit(label))
+        return false;
+    for (int k=0; k<4; k++)
+        on_leaf_edge(trie_v, edge_t::from_cost(u, to, nucls[k], ORIG));
+    return true;
+}
+
+// A walk in the reference from node v aligned to a trie node.
+struct walk_t {
+    node_t v;
+    int rem_depth;
+    node_t trie_v;
+};
 
-struct TrieNode {
-    int node;
-    int cnt;
-    TrieNode* children[4];
+// The trie nodes below one child of the root, allocated in an arena.
+// Node 0 is the child of the root.
+struct TrieArena {
+    struct Node {
+        nodesz children[4];
+        nodesz cnt;       // number of walks continuing from the node to a child
+        nodesz local_id;  // -1 until the node is added to the graph
+    };
 
-    TrieNode(int _node)
-        : node(_node), cnt(0) {
-        children[0] = children[1] = children[2] = children[3] = nullptr;
+    vector<Node> nodes;
+    node_t numbered;        // nodes added to the graph
+    edge_idx_t leaf_edges;  // edges to the reference
+    edge_idx_t first_edge;  // the first edge of the subtree in E
+
+    TrieArena() : numbered(0), leaf_edges(0), first_edge(-1) {
+        new_node();
     }
 
-    TrieNode* get_node(char label) {
-        ++cnt;
-        auto &p = children[nucl2num(label)];
-        if (p == nullptr)
-            p = new TrieNode(-1);
-        return p;
+    node_t new_node() {
+        nodes.push_back(Node{{-1, -1, -1, -1}, 0, -1});
+        return (node_t)nodes.size()-1;
     }
 
-    void del_node() {
-        for (int i=0; i<4; i++) {
-            if (children[i] != nullptr) {
-                children[i]->del_node();
-                delete children[i];
-            }
+    node_t get_child(node_t x, label_t label) {
+        int k = nucl2num(label);
+        nodes[x].cnt = nodes[x].cnt + 1;
+        if (nodes[x].children[k] == -1) {
+            node_t child = new_node();
+            nodes[x].children[k] = child;
         }
+        return nodes[x].children[k];
+    }
+
+    void number(node_t x) {
+        if (nodes[x].local_id == -1)
+            nodes[x].local_id = numbered++;
     }
 };
 
-void dfs_construct_trie(const graph_t &G, int v, int rem_depth, TrieNode *tree_v) {
-    for (int idx=G.V[v]; idx!=-1; idx=G.E[idx].next) {
-        const edge_t &e = G.E[idx];
-        assert(e.type == ORIG);
-        if (rem_depth > 0) {
-            TrieNode *next_tree_v = tree_v->get_node(e.label);
-            dfs_construct_trie(G, e.to, rem_depth-1, next_tree_v);
-        }
+// Runs f(k) for the subtrees below each of the 4 children of the trie root in parallel.
+template<typename F>
+void for_each_subtrie(F f) {
+    vector<thread> threads;
+    for (int k=0; k<4; k++)
+        threads.push_back(thread(f, k));
+    for (auto &t: threads)
+        t.join();
+}
+
+// Calls walk(S) for each reference node with S containing the walks starting from its edges with the given label.
+template<typename F>
+void for_each_first_edges(const graph_t &G, node_t ref_nodes, label_t first, int rem_depth, node_t trie_v, F walk) {
+    vector<walk_t> S;
+    for (node_t i=1; i<ref_nodes; i++) {
+        for (edge_idx_t idx=G.V[i]; idx!=-1; idx=G.E[idx].next)
+            if (graph_t::trie_mask(G.E[idx].label) & nucl_mask(first))
+                S.push_back(walk_t{G.E[idx].to, rem_depth, trie_v});
+        if (!S.empty())
+            walk(S);
     }
 }
 
-void dfs_trie_to_graph(const graph_t &G, int v, int rem_depth, TrieNode *tree_v, EdgeList *new_edges, int *curr_node, bool fixed_trie_depth) {
-    if (tree_v->node == -1) {
-        tree_v->node = *curr_node;
-        ++(*curr_node);
+// Builds the subtree of the explicit trie under the root edge labeled `first`, counts the walks through each node.
+void construct_subtrie(const graph_t &G, node_t ref_nodes, int tree_depth, label_t first, TrieArena *T) {
+    for_each_first_edges(G, ref_nodes, first, tree_depth-2, 0, [&](vector<walk_t> &S) {
+        while (!S.empty()) {
+            walk_t w = S.back(); S.pop_back();
+            if (w.rem_depth > 0)
+                for (edge_idx_t idx=G.V[w.v]; idx!=-1; idx=G.E[idx].next) {
+                    const edge_t &e = G.E[idx];
+                    assert(e.type == ORIG);
+                    for_each_nucl(e.label, [&](int k) {
+                        S.push_back(walk_t{e.to, w.rem_depth-1, T->get_child(w.trie_v, nucls[k])});
+                    });
+                }
+        }
+    });
+}
+
+// Walks the subtree again as it will be added to the graph: a node connects to the reference at the
+// maximal depth, at an N or, for a variable depth, as soon as only one walk passes through it.
+// Calls on_leaf_edge(trie_v, e) for each edge to the reference, which is labeled by a single nucleotide.
+template<typename F>
+void walk_subtrie(const graph_t &G, node_t ref_nodes, int tree_depth, bool fixed_trie_depth, label_t first, TrieArena *T, F on_leaf_edge) {
+    for_each_first_edges(G, ref_nodes, first, tree_depth-2, 0, [&](vector<walk_t> &S) {
+        T->number(0);
+        while (!S.empty()) {
+            walk_t w = S.back(); S.pop_back();
+            for (edge_idx_t idx=G.V[w.v]; idx!=-1; idx=G.E[idx].next) {
+                const edge_t &e = G.E[idx];
+                if (exit_trie(e.label, w.trie_v, w.v, e.to, on_leaf_edge))
+                    continue;
+                for_each_nucl(e.label, [&](int k) {
+                    if (w.rem_depth == 0 || (!fixed_trie_depth && T->nodes[w.trie_v].cnt == 1)) {
+                        on_leaf_edge(w.trie_v, edge_t::from_cost(w.v, e.to, nucls[k], ORIG));
+                    } else {
+                        node_t child = T->nodes[w.trie_v].children[k];
+                        T->number(child);
+                        S.push_back(walk_t{e.to, w.rem_depth-1, child});
+                    }
+                });
+            }
+        }
+    });
+}
+
+// Writes the edge a->b into the preallocated slots E[idx] and E_rev[idx]. The reverse edge is linked
+// only if b is in the trie; the reverse edges to the reference are linked afterwards (see add_tree).
+void write_trie_edge(graph_t *G, node_t a, node_t b, label_t label, edge_idx_t idx) {
+    G->E[idx] = edge_t(a, b, label, G->V[a], JUMP);
+    G->V[a] = idx;
+    bool to_trie = G->node_in_trie(b);
+    G->E_rev[idx] = edge_t(b, a, label, to_trie ? (edge_idx_t)G->V_rev[b] : -1, JUMP);
+    if (to_trie)
+        G->V_rev[b] = idx;
+}
+
+// Walks the implicit trie under the root edge labeled `first`, marks its nodes as present and
+// calls on_leaf_edge(trie_v, e) for each edge from the trie to the reference, which is labeled by a
+// single nucleotide: from the deepest level or, at an N, from above it.
+template<typename F>
+void walk_implicit_subtrie(graph_t *G, node_t ref_nodes, label_t first, F on_leaf_edge) {
+    int depth = G->trie_depth;
+    node_t first_child = G->trie_level_first[1] + nucl2num(first);
+    for_each_first_edges(*G, ref_nodes, first, depth-2, first_child, [&](vector<walk_t> &S) {
+        G->set_trie_present(first_child);
+        while (!S.empty()) {
+            walk_t w = S.back(); S.pop_back();
+            for (edge_idx_t idx=G->V[w.v]; idx!=-1; idx=G->E[idx].next) {
+                const edge_t &e = G->E[idx];
+                assert(e.type == ORIG);
+                if (exit_trie(e.label, w.trie_v, w.v, e.to, on_leaf_edge))
+                    continue;
+                for_each_nucl(e.label, [&](int k) {
+                    if (w.rem_depth == 0) {
+                        on_leaf_edge(w.trie_v, edge_t::from_cost(w.v, e.to, nucls[k], ORIG));
+                    } else {
+                        int d = depth-1 - w.rem_depth;
+                        node_t child = G->trie_level_first[d+1] + 4*(w.trie_v - G->trie_level_first[d]) + k;
+                        G->set_trie_present(child);
+                        S.push_back(walk_t{e.to, w.rem_depth-1, child});
+                    }
+                });
+            }
+        }
+    });
+}
+
+void add_implicit_tree(graph_t *G, int tree_depth) {
+    node_t ref_nodes = G->V.size();
+    G->init_implicit_trie(tree_depth);
+    node_t deepest = G->trie_level_first[tree_depth-1];
+
+    // The subtrees of different first letters cover disjoint ranges of each trie level, so they are
+    // built in parallel: first marking the nodes and counting the edges to the reference from the
+    // deepest level ([0]) and the exits from above it ([1])...
+    size_t first_leaf_edge[2][5] = {{0, 0, 0, 0, 0}, {0, 0, 0, 0, 0}};
+    for_each_subtrie([&](int k) {
+        walk_implicit_subtrie(G, ref_nodes, nucls[k], [&](node_t trie_v, const edge_t &e) {
+            ++first_leaf_edge[trie_v < deepest][k+1];
+        });
+    });
+    for (int exits=0; exits<2; exits++)
+        for (int k=0; k<4; k++)
+            first_leaf_edge[exits][k+1] += first_leaf_edge[exits][k];
+
+    // ...and then writing the edges sorted by source node and label into their part of trie_leaf_edges
+    // or trie_exit_edges. Until the edges are linked, `next` holds the source node.
+    auto by_source = [](const edge_t &a, const edge_t &b) {
+        if (a.next != b.next) return a.next < b.next;
+        if (a.label != b.label) return a.label < b.label;
+        return a.to < b.to; };
+    auto same = [](const edge_t &a, const edge_t &b) {
+        return a.next == b.next && a.label == b.label && a.to == b.to; };
+    graph_vector<edge_t> *edges[2] = {&G->trie_leaf_edges, &G->trie_exit_edges};
+    size_t unique_end[2][4];
+    for (int exits=0; exits<2; exits++)
+        edges[exits]->resize(first_leaf_edge[exits][4]);
+    for_each_subtrie([&](int k) {
+        size_t j[2] = {first_leaf_edge[0][k], first_leaf_edge[1][k]};
+        walk_implicit_subtrie(G, ref_nodes, nucls[k], [&](node_t trie_v, const edge_t &e) {
+            int exits = trie_v < deepest;
+            (*edges[exits])[j[exits]++] = edge_t(trie_v, e.to, e.label, trie_v, JUMP);
+        });
+        for (int exits=0; exits<2; exits++) {
+            auto from = edges[exits]->begin() + first_leaf_edge[exits][k], to = edges[exits]->begin() + first_leaf_edge[exits][k+1];
+            sort(from, to, by_source);
+            unique_end[exits][k] = unique(from, to, same) - edges[exits]->begin();
+        }
+    });
+
+    size_t total[2] = {0, 0};
+    for (int exits=0; exits<2; exits++) {
+        for (int k=0; k<4; k++)
+            for (size_t j=first_leaf_edge[exits][k]; j<unique_end[exits][k]; j++)
+                (*edges[exits])[total[exits]++] = (*edges[exits])[j];
+        edges[exits]->resize(total[exits]);
     }
+    sort(G->trie_exit_edges.begin(), G->trie_exit_edges.end(), by_source);  // the exits are from several levels
 
-    for (int idx=G.V[v]; idx!=-1; idx=G.E[idx].next) {
-        const edge_t &e = G.E[idx];
-        if (rem_depth == 0 || (!fixed_trie_depth && tree_v->cnt == 1)) {
-            // Connect to reference genome.
-            new_edges->push_back(make_pair(tree_v->node, make_pair(e.to, e.label)));
-        } else {
-            // Connect to deeper trie node.
-            TrieNode *next_tree_v = tree_v->get_node(e.label);
-            bool new_edge = (next_tree_v->node == -1);
-            dfs_trie_to_graph(G, e.to, rem_depth-1, next_tree_v, new_edges, curr_node, fixed_trie_depth);
-            if (new_edge)
-                new_edges->push_back(make_pair(tree_v->node, make_pair(next_tree_v->node, e.label)));
+    node_t present = 0;
+    G->trie_present_rank.resize(G->trie_present.size());
+    for (size_t w=0; w<G->trie_present.size(); w++) {
+        G->trie_present_rank[w] = present;
+        present += __builtin_popcountll(G->trie_present[w]);
+    }
+
+    node_t leaves = present - G->trie_present_before(deepest);  // the deepest level is the last one
+    G->trie_leaf_first.assign(leaves+1, 0);
+    G->trie_exit_from.resize(total[1]);
+    G->E_rev.reserve(G->E_rev.size() + total[0] + total[1]);
+    for (int exits=0; exits<2; exits++)
+        for (size_t j=0; j<total[exits]; j++) {
+            edge_t &e = (*edges[exits])[j];
+            node_t from = e.next;
+            e.next = (j+1 < total[exits] && (*edges[exits])[j+1].next == from) ? j+1 : -1;
+            if (exits)
+                G->trie_exit_from[j] = from;
+            else
+                ++G->trie_leaf_first[G->trie_present_before(from) - G->trie_present_before(deepest) + 1];
+
+            // The reverse edges to the trie are stored with the reference.
+            G->E_rev.push_back(edge_t(e.to, from, e.label, G->V_rev[e.to], JUMP));
+            G->V_rev[e.to] = (edge_idx_t)G->E_rev.size()-1;
+        }
+    for (node_t k=0; k<leaves; k++)
+        G->trie_leaf_first[k+1] += G->trie_leaf_first[k];
+
+    G->trie_nodes = present;
+    G->trie_edges = present + total[0] + total[1];
+}
+
+// Calls on_path(u) for the first node of each path if the reference is made of disjoint paths of
+// nucleotide edges. Returns false if it is not.
+template<typename F>
+bool for_each_reference_path(const graph_t &G, node_t ref_nodes, F on_path) {
+    vector<uint8_t> in(ref_nodes, 0);
+    size_t edges = 0;
+    for (node_t u=1; u<ref_nodes; u++) {
+        int out = 0;
+        for (edge_idx_t idx=G.V[u]; idx!=-1; idx=G.E[idx].next) {
+            const edge_t &e = G.E[idx];
+            if (e.type != ORIG || graph_t::nucl_index(e.label) == -1 || ++out > 1 || ++in[e.to] > 1)
+                return false;
+            ++edges;
         }
     }
+
+    size_t path_edges = 0;
+    for (node_t u=1; u<ref_nodes; u++)
+        if (in[u] == 0 && G.V[u] != -1) {
+            for (node_t v = u; G.V[v] != -1; v = G.E[G.V[v]].to)
+                ++path_edges;
+            on_path(u);
+        }
+    return path_edges == edges;  // no cycles
+}
+
+bool is_linear_reference(const graph_t &G) {
+    return for_each_reference_path(G, G.V.size(), [](node_t u) {});
+}
+
+// For a reference made of disjoint paths, writes the text of the paths, each followed by a separator
+// (after an initial separator), and the node at each text position: the source of the edge or, at a
+// separator, the end of the path. Returns false if the reference is not of this form.
+bool linear_reference_text(const graph_t &G, node_t ref_nodes, vector<uint8_t> *text, vector<node_t> *node_at) {
+    text->assign(1, FMIndex::SEP);
+    node_at->assign(1, -1);
+    return for_each_reference_path(G, ref_nodes, [&](node_t u) {
+        node_t v = u;
+        for (; G.V[v] != -1; v = G.E[G.V[v]].to) {
+            text->push_back(nucl2num(G.E[G.V[v]].label));
+            node_at->push_back(v);
+        }
+        text->push_back(FMIndex::SEP);
+        node_at->push_back(v);
+    }) && text->size() <= INT_MAX;
+}
+
+const int FM_SAMPLE_RATE = 32;
+
+// Indexes a linear reference for the FM-index trie. A row of the FM-index is the reversed text up to
+// some position, so backward search extends a prefix forward; the row keeps the node at that position
+// if it is a separator or a multiple of FM_SAMPLE_RATE. The FM-index keeps 32-bit rows and nodes.
+bool add_fm_tree(graph_t *G, int tree_depth) {
+    node_t ref_nodes = G->V.size();
+    vector<uint8_t> text;
+    vector<node_t> node_at;
+    if (ref_nodes > INT_MAX || !linear_reference_text(*G, ref_nodes, &text, &node_at))
+        return false;
+
+    int n = text.size();
+    reverse(text.begin(), text.end());
+    G->fm.build(text, [&](int i) {
+        int pos = n - i;  // in the original text
+        if (i == 0 || (text[n-1-pos] != FMIndex::SEP && pos % FM_SAMPLE_RATE != 0))
+            return -1;
+        return int(node_at[pos]);
+    });
+
+    G->fm_trie = true;
+    G->init_implicit_trie(tree_depth);
+    G->trie_nodes = 0;  // not enumerated
+    G->trie_edges = 0;
+    return true;
+}
+
+// Prepares a trie whose nodes are built while aligning (see graph_t::lazy_trie_expand).
+void add_lazy_tree(graph_t *G, int tree_depth, size_t max_bytes) {
+    G->lazy_trie = true;
+    G->lazy_trie_max_bytes = max_bytes;
+    G->init_implicit_trie(tree_depth);
+    G->lazy_trie_nodes[0].reset(new lazy_trie_node_t());
+    G->trie_nodes = 0;  // not enumerated
+    G->trie_edges = 0;
 }
 
-void add_tree(graph_t *G, int tree_depth, bool fixed_trie_depth) {
-    TrieNode tree_root(0);
-    EdgeList new_edges;
-    int curr_node=G->V.size();
-    G->trie_first_node = curr_node;
+void add_tree(graph_t *G, int tree_depth, bool fixed_trie_depth, bool fm_index, double lazy_trie_gb) {
+    if (fixed_trie_depth && tree_depth >= 2) {
+        G->fixed_trie_depth = true;
+        if (fm_index) {
+            if (add_fm_tree(G, tree_depth)) {
+                LOG_INFO << "FM-index trie of depth " << tree_depth << " for a text of " << G->fm.size() << " letters";
+                return;
+            }
+            LOG_WARNING << "The reference is not linear or too big: building an implicit trie instead of an FM-index.";
+        }
+        if (lazy_trie_gb > 0.0) {
+            LOG_INFO << "Lazy trie of depth " << tree_depth << " with up to " << lazy_trie_gb << "gb of frontiers";
+            add_lazy_tree(G, tree_depth, size_t(lazy_trie_gb * 1024 * 1024 * 1024));
+            return;
+        }
+        LOG_INFO << "Implicit trie of depth " << tree_depth;
+        add_implicit_tree(G, tree_depth);
+        LOG_INFO << " Nodes of the trie >= " << G->trie_first_node;
+        return;
+    }
+
+    node_t ref_nodes = G->V.size();
+    G->trie_first_node = ref_nodes;
     G->trie_depth = tree_depth;
     G->fixed_trie_depth = fixed_trie_depth;
 
@@ -86,34 +390,177 @@ void add_tree(graph_t *G, int tree_depth, bool fixed_trie_depth) {
     LOG_INFO << "          Trie depth: " << G->trie_depth;
     LOG_INFO << "    Fixed trie depth: " << G->fixed_trie_depth;
 
-    try {
-        // Construct Trie.
-        for (size_t i=1; i<G->V.size(); i++)
-            dfs_construct_trie(*G, i, tree_depth-1, &tree_root);
-        // Extrect edges to be added to the graph.
-        for (size_t i=1; i<G->V.size(); i++)
-            dfs_trie_to_graph(*G, i, tree_depth-1, &tree_root, &new_edges, &curr_node, fixed_trie_depth);
-    } catch (std::bad_alloc& ba) {
-        std::cerr << "new_edges.size(): " << new_edges.size() << '\n';
-        std::cerr << "bad_alloc caught: " << ba.what() << '\n';
-        throw;
+    edge_idx_t root_walks = 0;
+    for (node_t i=1; i<ref_nodes; i++)
+        for (edge_idx_t idx=G->V[i]; idx!=-1; idx=G->E[idx].next)
+            root_walks += __builtin_popcount(graph_t::trie_mask(G->E[idx].label));
+
+    if (tree_depth == 1 || (!fixed_trie_depth && root_walks == 1)) {
+        // The root connects directly to the reference.
+        for (node_t i=1; i<ref_nodes; i++)
+            for (edge_idx_t idx=G->V[i]; idx!=-1; idx=G->E[idx].next) {
+                edge_t e = G->E[idx];
+                for_each_nucl(e.label, [&](int k) {
+                    G->add_edge(0, e.to, nucls[k], JUMP);
+                });
+            }
+        G->trie_nodes = 0;
+        G->trie_edges = root_walks;
+        return;
     }
 
-    G->trie_nodes = curr_node - (int)G->V.size();
-    G->trie_edges = new_edges.size();
+    // Count the walks through each trie node, then number the nodes that are added to the graph.
+    TrieArena T[4];
+    for_each_subtrie([&](int k) {
+        construct_subtrie(*G, ref_nodes, tree_depth, nucls[k], &T[k]);
+        walk_subtrie(*G, ref_nodes, tree_depth, fixed_trie_depth, nucls[k], &T[k], [&](node_t trie_v, const edge_t &e) {
+            ++T[k].leaf_edges;
+        });
+    });
+
+    // Place the subtrees one after another in V and E.
+    assert(G->E.size() == G->E_rev.size());
+    edge_idx_t trie_first_edge = G->E.size();
+    node_t first_node[4];
+    node_t curr_node = ref_nodes;
+    edge_idx_t curr_edge = trie_first_edge;
+    for (int k=0; k<4; k++) {
+        first_node[k] = curr_node;
+        T[k].first_edge = curr_edge;
+        curr_node += T[k].numbered;
+        curr_edge += max(T[k].numbered-1, node_t(0)) + T[k].leaf_edges;
+    }
 
-    try {
-        // Add the tree edges to astarix
-        while ((int)G->V.size() < curr_node)
-            G->add_node();
-        for (const auto &e: new_edges) {
-            G->add_edge(e.first, e.second.first, e.second.second, JUMP);
+    G->V.resize(curr_node, -1);
+    G->V_rev.resize(curr_node, -1);
+    G->E.resize(curr_edge);
+    G->E_rev.resize(curr_edge);
+
+    // Write the edges of each subtree straight into the graph.
+    for_each_subtrie([&](int k) {
+        TrieArena &A = T[k];
+        edge_idx_t idx = A.first_edge;
+        for (const auto &x: A.nodes)
+            if (x.local_id != -1)
+                for (int c=0; c<4; c++)
+                    if (x.children[c] != -1 && A.nodes[x.children[c]].local_id != -1)
+                        write_trie_edge(G, first_node[k] + x.local_id, first_node[k] + A.nodes[x.children[c]].local_id, nucls[c], idx++);
+        walk_subtrie(*G, ref_nodes, tree_depth, fixed_trie_depth, nucls[k], &A, [&](node_t trie_v, const edge_t &e) {
+            write_trie_edge(G, first_node[k] + A.nodes[trie_v].local_id, e.to, e.label, idx++);
+        });
+        vector<TrieArena::Node>().swap(A.nodes);
+    });
+
+    // Link the reverse edges to the reference and connect the root.
+    for (edge_idx_t idx=trie_first_edge; idx<curr_edge; idx++) {
+        node_t b = G->E[idx].to;
+        if (!G->node_in_trie(b)) {
+            G->E_rev[idx].next = G->V_rev[b];
+            G->V_rev[b] = idx;
+        }
+    }
+    for (int k=0; k<4; k++)
+        if (T[k].numbered > 0)
+            G->add_edge(0, first_node[k], nucls[k], JUMP);
+
+    G->trie_nodes = curr_node - ref_nodes;
+    G->trie_edges = G->E.size() - trie_first_edge;
+}
+
+// Extrapolates the number of walks of each length 0..max_depth from all reference nodes by counting
+// them from every step-th node. The walks from a node are counted per end node until there are
+// MAX_FRONTIER ends; the longer walks grow by the last branching factor.
+vector<double> sample_reference_walks(const graph_t &G, int max_depth) {
+    const int SAMPLES = 1000;
+    const size_t MAX_FRONTIER = 10000;
+    node_t ref_nodes = G.V.size();
+    vector<double> walks(max_depth+1, 0.0);
+    if (ref_nodes <= 1)
+        return walks;
+
+    node_t step = max(node_t(1), (ref_nodes-1) / SAMPLES);
+    int sampled = 0;
+    for (node_t u=1; u<ref_nodes; u+=step, ++sampled) {
+        map<node_t, double> frontier = {{u, 1.0}};  // end node -> walks
+        double curr = 1.0, branching = 1.0;
+        for (int d=0; d<=max_depth; d++) {
+            walks[d] += curr;
+            if (curr == 0.0 || frontier.size() > MAX_FRONTIER) {
+                curr *= branching;
+                continue;
+            }
+            map<node_t, double> next;
+            double next_walks = 0.0;
+            for (const auto &p: frontier)
+                for (edge_idx_t idx=G.V[p.first]; idx!=-1; idx=G.E[idx].next) {
+                    double letters = __builtin_popcount(graph_t::trie_mask(G.E[idx].label));
+                    next[G.E[idx].to] += letters * p.second;
+                    next_walks += letters * p.second;
+                }
+            branching = next_walks / curr;
+            curr = next_walks;
+            frontier.swap(next);
         }
-    } catch (std::bad_alloc& ba) {
-        std::cerr << "G->V.size(): " << G->V.size() << '\n';
-        std::cerr << "bad_alloc caught: " << ba.what() << '\n';
-        throw;
     }
 
-    tree_root.del_node();
+    for (double &w: walks)
+        w *= double(ref_nodes-1) / sampled;
+    return walks;
+}
+
+// Models the trie sizes assuming that the walks spell random strings: a level with k prefixes and w
+// walks has k*(1-e^(-w/k)) distinct prefixes. The bytes follow graph_t::trie_mem_bytes with the
+// reverse edges and nodes (E_rev, V_rev) added, and the build peak includes the temporary arenas,
+// the copies of the resized edges or the suffix array. For a lazy trie, only the node ids are set.
+trie_size_t estimate_trie_size(const graph_t &G, const vector<double> &walks, int tree_depth, trie_layout_t layout) {
+    assert((int)walks.size() > tree_depth);
+    const double edge = sizeof(edge_t), id = sizeof(nodesz);
+    auto level = [](int d) { return pow(4.0, d); };
+    auto present = [&](int d) { return level(d) * -expm1(-walks[d] / level(d)); };
+    auto unique = [&](int d) { return d == 0 ? 0.0 : exp(-walks[d] / level(d)); };  // probability that no other walk shares the prefix
+
+    trie_size_t size;
+    if (tree_depth == 1) {  // the root connects to the reference
+        size.kept_bytes = size.build_bytes = 2 * walks[1] * edge;
+        return size;
+    }
+
+    switch (layout) {
+        case VARIABLE_TRIE: {
+            // A walk leaves the trie from the first node that only it passes through.
+            double nodes = 0.0, leaf_edges = 0.0, arena = 0.0;
+            for (int d=1; d<tree_depth; d++) {
+                double singles = walks[d-1] * unique(d-1);  // parents with one walk
+                nodes += max(present(d) - (d == 1 ? 0.0 : singles * walks[d] / max(walks[d-1], 1.0)), 0.0);
+                arena += present(d) * sizeof(TrieArena::Node);
+                double stop = d+1 < tree_depth ? unique(d) - unique(d-1) : 1.0 - unique(d-1);
+                leaf_edges += walks[d+1] * max(stop, 0.0);
+            }
+            size.kept_bytes = 2 * ((nodes + leaf_edges) * edge + nodes * id);
+            size.build_bytes = size.kept_bytes + arena;
+            if (G.E.size() + nodes + leaf_edges > G.E.capacity())  // E and E_rev are copied when resized
+                size.build_bytes += 2 * G.E.size() * edge;
+            size.nodes = nodes;
+            return size;
+        }
+        case FIXED_TRIE: {
+            double bits = 0.0;
+            for (int d=1; d<tree_depth; d++)
+                bits += level(d);
+            size.kept_bytes = bits / 8 + bits / 64 * id + present(tree_depth-1) * id + 2 * walks[tree_depth] * edge;
+            size.build_bytes = size.kept_bytes;
+            break;
+        }
+        case FM_TRIE: {
+            double letters = walks[1];
+            size.kept_bytes = letters * (FMIndex::block_bytes() / 64.0 + id / FM_SAMPLE_RATE);
+            size.build_bytes = letters * (4 * id + 1 + id);     // suffix array construction, text and nodes
+            break;
+        }
+        case LAZY_TRIE:
+            break;  // bounded by its own ceiling
+    }
+    for (int d=1; d<tree_depth; d++)  // the implicit node ids
+        size.nodes += level(d);
+    return size;
 }
@@ -1,5 +1,29 @@
 #pragma once
 
+#include <vector>
+
 #include "graph.h"
 
-void add_tree(astarix::graph_t *G, int tree_depth, bool fixed_trie_depth);
+void add_tree(astarix::graph_t *G, int tree_depth, bool fixed_trie_depth, bool fm_index, double lazy_trie_gb);
+
+// Layouts of the trie built by add_tree.
+enum trie_layout_t {
+    VARIABLE_TRIE,  // explicit, leaves can be shallower than the trie depth
+    FIXED_TRIE,     // implicit, all leaves at the trie depth
+    FM_TRIE,        // FM-index of a linear reference
+    LAZY_TRIE,      // expanded while aligning
+};
+
+// Estimated memory of a trie: while building it and afterwards, and the number of node ids it takes.
+struct trie_size_t {
+    double build_bytes, kept_bytes;
+    double nodes;
+
+    trie_size_t() : build_bytes(0.0), kept_bytes(0.0), nodes(0.0) {}
+};
+
+bool is_linear_reference(const astarix::graph_t &G);
+
+// walks[d] -- the estimated number of walks of length d in the reference (before the trie is added).
+std::vector<double> sample_reference_walks(const astarix::graph_t &G, int max_depth);
+trie_size_t estimate_trie_size(const astarix::graph_t &G, const std::vector<double> &walks, int tree_depth, trie_layout_t layout);
@@ -35,6 +35,22 @@ void process_mem_usage(double& vm_usage, double& resident_set) {
    resident_set = rss * page_size_kb;
 }
 
+// The time-stamp counter is calibrated against the steady clock since the start of the program,
+// over at least 10ms.
+static const auto calibration_start_time = std::chrono::steady_clock::now();
+static const int64_t calibration_start_cycles = CycleClock::now();
+
+double cycles_per_sec() {
+    static const double rate = [] {
+        std::chrono::duration<double> elapsed;
+        do {
+            elapsed = std::chrono::steady_clock::now() - calibration_start_time;
+        } while (elapsed.count() < 0.01);
+        return (CycleClock::now() - calibration_start_cycles) / elapsed.count();
+    }();
+    return rate;
+}
+
 double b2gb(size_t bytes) {
     return bytes / 1024.0 / 1024.0 / 1024.0;
 }
@@ -60,6 +76,15 @@ char compl_nucl(char c) {
     else if (c == 'C') return 'G';
     else if (c == 'G') return 'C';
     else if (c == 'T') return 'A';
+    else if (c == 'R') return 'Y';
+    else if (c == 'Y') return 'R';
+    else if (c == 'K') return 'M';
+    else if (c == 'M') return 'K';
+    else if (c == 'B') return 'V';
+    else if (c == 'V') return 'B';
+    else if (c == 'D') return 'H';
+    else if (c == 'H') return 'D';
+    else if (c == 'S' || c == 'W' || c == 'N') return c;
 	else 
 		throw std::string("Bad nucleotide '") + c + "'";
 }
@@ -94,7 +119,7 @@ bool is_extended_nucl(char nucl) {
 
 bool are_all_nucls(const std::string &s) {
     for (char c: s) {
-        if (!is_nucl(toupper(c))) {
+        if (!is_nucl(toupper(c)) && !is_extended_nucl(toupper(c))) {
             std::cerr << "Not a nucleotide: [" << c << "]" << std::endl;
             return false;
         }
@@ -106,22 +131,6 @@ void write(std::ostream& os, int from, const edge_t &e) {
     os << from << " " << e.to << " " << e.label << " " << edgeType2str(e.type); 
 }
 
-std::string extended2orignucls(char nucl) {
-    if (nucl == 'R') return "AG";
-    if (nucl == 'Y') return "CT";
-    if (nucl == 'K') return "GT";
-    if (nucl == 'M') return "AC";
-    if (nucl == 'S') return "CG";
-    if (nucl == 'W') return "AT";
-    if (nucl == 'B') return "CGT";
-    if (nucl == 'D') return "AGT";
-    if (nucl == 'H') return "ACT";
-    if (nucl == 'V') return "ACG";
-    if (nucl == 'N') return "ACGT";
-    assert(is_nucl(nucl));
-    return "!";
-}
-
 double sample() {
     return 1.0 * rand() / INT_MAX;
 }
@@ -2,16 +2,23 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <ctime>
 #include <fstream>
 #include <ios>
 #include <iostream>
 #include <limits.h>
+#include <list>
 #include <string>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 #include <queue>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 namespace astarix {
 
@@ -24,7 +31,17 @@ namespace astarix {
 typedef int				cost_t;
 typedef char			label_t;
 typedef short			pos_t;
+
+// Node ids and edge indices are 32-bit unless built with WIDE_IDS=1 (see nodesz).
+#ifdef WIDE_IDS
+typedef int64_t			node_t;
+typedef int64_t			edge_idx_t;
+const node_t MAX_IDS = (int64_t(1) << 39) - 1;
+#else
 typedef int				node_t;
+typedef int				edge_idx_t;
+const node_t MAX_IDS = INT_MAX;
+#endif
 
 class state_t;
 typedef std::pair<cost_t, state_t>                                      score_state_t;
@@ -48,13 +65,50 @@ double b2gb(size_t bytes);  // bytes to gb
 
 double log(double base, double x);
 
-class Timer {
-    clock_t start_time;
-    clock_t accum_time;
+// Timers of the time spent. PhaseTimer reads the CPU clock of the process, so that a phase includes
+// the threads it spawns (e.g. building the trie). Timer reads the CPU clock of the calling thread and
+// is meant for reads; CycleTimer reads the time-stamp counter, which is cheap enough to time every
+// heuristic query. Building with INSTRUMENT=0 (NO_INSTRUMENT) compiles the CycleTimers out.
+template<clockid_t CLOCK>
+struct CpuClock {
+    static int64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK, &ts);
+        return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static double to_sec(int64_t ticks) {
+        return ticks * 1e-9;
+    }
+};
+
+typedef CpuClock<CLOCK_THREAD_CPUTIME_ID> ThreadCpuClock;
+typedef CpuClock<CLOCK_PROCESS_CPUTIME_ID> ProcessCpuClock;
+
+double cycles_per_sec();  // of CycleClock, calibrated on the first call
+
+struct CycleClock {
+    static int64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static double to_sec(int64_t ticks) {
+        return ticks / cycles_per_sec();
+    }
+};
+
+template<typename Clock, bool enabled = true>
+class BasicTimer {
+    int64_t start_time;
+    int64_t accum_time;
     bool running;
 
   public:
-    Timer() : accum_time(0), running(false) {}
+    BasicTimer() : accum_time(0), running(false) {}
 
     void clear() {
         accum_time = 0;
@@ -64,32 +118,41 @@ class Timer {
     void start() {
         assert(!running);
         running = true;
-//#ifdef DEBUG
-        start_time = std::clock();
-//#endif
+        if constexpr (enabled)
+            start_time = Clock::now();
     }
 
     void stop() {
-//#ifdef DEBUG
-        accum_time += std::clock() - start_time;
-//#endif
+        if constexpr (enabled)
+            accum_time += Clock::now() - start_time;
         assert(running);
         running = false;
     }
 
     double get_sec() const {
         assert(!running);
-        return (double)accum_time / (double)CLOCKS_PER_SEC;
+        return Clock::to_sec(accum_time);
     }
 
-    Timer& operator+=(const Timer &b) {
+    BasicTimer& operator+=(const BasicTimer &b) {
         accum_time += b.accum_time;
         return *this;
     }
 };
 
+typedef BasicTimer<ProcessCpuClock> PhaseTimer;
+typedef BasicTimer<ThreadCpuClock> Timer;
+#ifdef NO_INSTRUMENT
+typedef BasicTimer<CycleClock, false> CycleTimer;
+const bool INSTRUMENTED = false;
+#else
+typedef BasicTimer<CycleClock> CycleTimer;
+const bool INSTRUMENTED = true;
+#endif
+
 struct AlignerTimers {
-    Timer ff, astar, total;
+    CycleTimer ff, astar;        // per expanded state
+    Timer total;                 // per read
     Timer astar_prepare_reads;
 
     void clear() {
@@ -189,6 +252,60 @@ class Counter {
     }
 };
 
+// Least recently used cache bounded by the total size() of the cached values.
+template<typename K, typename V, typename Hash = std::hash<K>>
+class LRUCache {
+    typedef std::pair<K, V> entry_t;
+
+    std::list<entry_t> entries;  // the most recently used first
+    std::unordered_map<K, std::pair<typename std::list<entry_t>::iterator, size_t>, Hash> index;  // with the counted size
+    size_t capacity, total_size;
+
+    void evict() {
+        while (total_size > capacity) {
+            total_size -= index[entries.back().first].second;
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+  public:
+    LRUCache(size_t _capacity=0) : capacity(_capacity), total_size(0) {}
+
+    // Returns nullptr if the key is not cached.
+    const V *get(const K &key) {
+        auto it = index.find(key);
+        if (it == index.end())
+            return nullptr;
+        entries.splice(entries.begin(), entries, it->second.first);
+        return &it->second.first->second;
+    }
+
+    void put(const K &key, V &&value) {
+        if (value.size() > capacity || index.find(key) != index.end())
+            return;
+        total_size += value.size();
+        evict();
+        entries.emplace_front(key, std::move(value));
+        index[key] = std::make_pair(entries.begin(), entries.front().second.size());
+    }
+
+    // Counts the new size() of a cached value which has changed; evicts the least recently used values
+    // (possibly including this one) to stay within the capacity.
+    void update_size(const K &key) {
+        auto it = index.find(key);
+        if (it == index.end())
+            return;
+        total_size += it->second.first->second.size() - it->second.second;
+        it->second.second = it->second.first->second.size();
+        evict();
+    }
+
+    size_t size() const {
+        return total_size;
+    }
+};
+
 inline std::string bool2str(bool x) {
     return x ? "true" : "false";
 }
@@ -197,19 +314,33 @@ enum EdgeType : char {
     ORIG, INS, DEL, SUBST, JUMP, EdgeType_after_type
 };
 
+// A node id or an edge index as stored in the graph. With WIDE_IDS, it takes 40 bits packed in 5
+// bytes, so that an edge_t stays 12 bytes.
+#ifdef WIDE_IDS
+class __attribute__((packed)) nodesz {
+    uint32_t lo;
+    int8_t hi;
+
+  public:
+    nodesz() {}
+    nodesz(int64_t x) : lo(uint32_t(x)), hi(int8_t(x >> 32)) {}
+    operator int64_t() const { return (int64_t(hi) << 32) | lo; }
+};
+#else
 typedef int nodesz;
+#endif
 
 struct edge_t {
-    nodesz to;    // 4 bytes, the end point of the edge
-    nodesz next;  // 4 bytes, E[next] -- prev added outgoing edge from the same source
+    nodesz to;    // 4 (or 5) bytes, the end point of the edge
+    nodesz next;  // 4 (or 5) bytes, E[next] -- prev added outgoing edge from the same source
     label_t label; // 1 byte automata label
     EdgeType type;  // 1 byte
 
     edge_t() : to(-1), next(-1), label(EPS), type(ORIG) {}
-    edge_t(int _from, int _to, label_t _label, int _next, EdgeType _type=ORIG, int _node_id=-1, int _offset=-1)
+    edge_t(node_t _from, node_t _to, label_t _label, edge_idx_t _next, EdgeType _type=ORIG, int _node_id=-1, int _offset=-1)
         : to(_to), next(_next), label(_label), type(_type) {}
 
-    static edge_t from_cost(int _from, int _to, label_t _label, EdgeType _type) {
+    static edge_t from_cost(node_t _from, node_t _to, label_t _label, EdgeType _type) {
         edge_t e;
         e.to = _to;
         e.label = _label;
@@ -269,8 +400,34 @@ bool is_extended_nucl(char nucl);
 bool are_all_nucls(const std::string &s);
 void write(std::ostream& os, int from, const edge_t &e);
 
-// from a letter denoting a subset to a list of nucleotides
-std::string extended2orignucls(char nucl);
+// from a letter denoting a subset (IUPAC) to a mask of nucleotides: bit k for nucls[k]; 0 if not a letter
+inline int nucl_mask(char nucl) {
+    switch (nucl) {
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 4;
+        case 'T': return 8;
+        case 'R': return 1|4;
+        case 'Y': return 2|8;
+        case 'K': return 4|8;
+        case 'M': return 1|2;
+        case 'S': return 2|4;
+        case 'W': return 1|8;
+        case 'B': return 2|4|8;
+        case 'D': return 1|4|8;
+        case 'H': return 1|2|8;
+        case 'V': return 1|2|4;
+        case 'N': return 1|2|4|8;
+        default: return 0;
+    }
+}
+
+// Whether an edge label (a nucleotide or a subset of them) matches a query letter. A query N only
+// matches an N in the reference.
+inline bool label_matches(label_t label, char c) {
+    int m = nucl_mask(c);
+    return label == c || ((m & (m-1)) == 0 && (nucl_mask(label) & m));
+}
 
 // in [0,1]
 double sample();
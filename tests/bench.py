@@ -0,0 +1,176 @@
+"""End-to-end benchmark of astarix over a fixed matrix of graphs x read sets x algorithms.
+
+Records the throughput (reads/s), the explored states per read bp, the peak RSS and whether the
+algorithms agree on the optimal alignment costs to a JSON file. Given a baseline (an earlier output),
+fails if a run regresses beyond the threshold or if the algorithms disagree on a cost.
+
+    python3 tests/bench.py --astarix release/astarix --out tmp/bench/bench.json [--baseline BASELINE.json]
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+GRAPHS = {
+    'ecoli10k': 'data/ecoli_head10000_linear/graph.gfa',
+    'ecoli1M': 'data/ecoli_head1000000_linear/graph.gfa',
+}
+
+READS = {
+    'ecoli10k': { 'illumina100': 'data/ecoli_head10000_linear/illumina.fq' },
+    'ecoli1M': {
+        'illumina100': 'data/ecoli_head1000000_linear/illumina.fq',
+        'illumina150': 'data/ecoli_head1000000_linear/illumina150.fq',
+        'illumina250': 'data/ecoli_head1000000_linear/illumina250.fq',
+    },
+}
+
+ALGORITHMS = ['dijkstra', 'astar-prefix', 'astar-seeds']
+
+# Dijkstra takes minutes per read on the 250bp reads.
+SKIP = { ('ecoli1M', 'illumina250', 'dijkstra') }
+
+# Larger is better for throughput; smaller is better for the rest.
+METRICS = { 'reads_per_sec': +1, 'explored_per_bp': -1, 'peak_rss_mb': -1 }
+
+
+def head_fastq(src, dst, reads):
+    with open(src) as f, open(dst, 'w') as out:
+        for i, line in enumerate(f):
+            if i >= 4*reads:
+                break
+            out.write(line)
+
+
+def read_costs(alignments_tsv):
+    costs = {}
+    with open(alignments_tsv) as f:
+        header = f.readline().rstrip('\n').split('\t')
+        name, cost = header.index('readname'), header.index('cost')
+        for line in f:
+            cols = line.rstrip('\n').split('\t')
+            costs[cols[name]] = int(cols[cost])
+    return costs
+
+
+def measure(astarix, algo, graph, reads, outdir, repeats, min_time):
+    """The run with the best throughput, out of at least the given repeats and at least min_time
+    seconds of aligning (so that short runs are repeated enough to be timed reliably)."""
+    best = None
+    runs, align_time = 0, 0.0
+    while runs < repeats or align_time < min_time:
+        os.makedirs(outdir, exist_ok=True)
+        cmd = [astarix, 'align-optimal', '-a', algo, '-t', '1', '-v', '0', '-g', graph, '-q', reads,
+               '-o', outdir, '--fixed_trie_depth', '1']
+        proc = subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        stdout = proc.stdout.read()
+        _, status, usage = os.wait4(proc.pid, 0)
+        with open(outdir + '.out', 'w') as log:
+            log.write(stdout)
+        if status != 0:
+            sys.exit('Failed ({}): {}'.format(status, ' '.join(cmd)))
+
+        m = re.search(r'align \(wall time\): (\S+)s = (\S+) reads/s', stdout)
+        runs, align_time = runs + 1, align_time + float(m.group(1))
+        reads_per_sec = float(m.group(2))
+        explored = float(re.search(r'Explored rate \(avg\): (\S+) states/read_bp', stdout).group(1))
+        run = {
+            'reads_per_sec': reads_per_sec,
+            'explored_per_bp': explored,
+            'peak_rss_mb': usage.ru_maxrss / 1024.0,  # ru_maxrss is in KB on Linux
+        }
+        if best is None or run['reads_per_sec'] > best['reads_per_sec']:
+            best = run
+    best['costs'] = read_costs(os.path.join(outdir, 'alignments.tsv'))
+    return best
+
+
+def agreement(runs):
+    """The fraction of reads on which each algorithm finds the same optimal cost as the first one run."""
+    ref = next(iter(runs.values()))['costs']
+    return { algo: sum(run['costs'].get(r) == c for r, c in ref.items()) / len(ref)
+             for algo, run in runs.items() }
+
+
+def compare(results, baseline, threshold):
+    """The regressions of results against the baseline beyond the relative threshold."""
+    base = { (r['graph'], r['reads'], r['algorithm']): r for r in baseline['runs'] }
+    regressions = []
+    for r in results['runs']:
+        b = base.get((r['graph'], r['reads'], r['algorithm']))
+        if b is None:
+            continue
+        for metric, sign in METRICS.items():
+            change = (r[metric] - b[metric]) / b[metric] if b[metric] else 0.0
+            if sign * change < -threshold:
+                regressions.append('{} {} {}: {} {:.4g} -> {:.4g} ({:+.1f}%)'.format(
+                    r['graph'], r['reads'], r['algorithm'], metric, b[metric], r[metric], 100*change))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--astarix', default='release/astarix')
+    parser.add_argument('--out', default='tmp/bench/bench.json', help='results (JSON)')
+    parser.add_argument('--baseline', help='earlier results to compare to (skipped if missing)')
+    parser.add_argument('--threshold', type=float, default=0.1, help='relative change counted as a regression [0.1]')
+    parser.add_argument('--reads', type=int, default=200, help='reads of each read set [200]')
+    parser.add_argument('--repeats', type=int, default=3, help='runs of each configuration; the fastest counts [3]')
+    parser.add_argument('--min_time', type=float, default=1.0, help='more runs until aligning took that many seconds [1.0]')
+    args = parser.parse_args()
+
+    workdir = os.path.join(os.path.dirname(args.out) or '.', 'runs')
+    os.makedirs(workdir, exist_ok=True)
+
+    results = { 'astarix': args.astarix, 'reads': args.reads, 'runs': [], 'agreement': [] }
+    for graph, graph_file in GRAPHS.items():
+        for reads, reads_file in READS[graph].items():
+            sample = os.path.join(workdir, '{}-{}.fq'.format(graph, reads))
+            head_fastq(reads_file, sample, args.reads)
+            runs = {}
+            for algo in ALGORITHMS:
+                if (graph, reads, algo) in SKIP:
+                    continue
+                runs[algo] = measure(args.astarix, algo, graph_file, sample,
+                                     os.path.join(workdir, '{}-{}-{}'.format(graph, reads, algo)), args.repeats, args.min_time)
+                print('{:9} {:12} {:13} {:10.1f} reads/s {:8.3f} states/bp {:8.1f} MB'.format(
+                    graph, reads, algo, runs[algo]['reads_per_sec'], runs[algo]['explored_per_bp'], runs[algo]['peak_rss_mb']))
+            for algo, run in runs.items():
+                results['runs'].append({ 'graph': graph, 'reads': reads, 'algorithm': algo,
+                                         **{ m: run[m] for m in METRICS } })
+            results['agreement'].append({ 'graph': graph, 'reads': reads, 'reference': next(iter(runs)),
+                                         'cost_agreement': agreement(runs) })
+
+    with open(args.out, 'w') as f:
+        json.dump(results, f, indent=2)
+    print('Results written to ' + args.out)
+
+    failed = False
+    for a in results['agreement']:
+        for algo, frac in a['cost_agreement'].items():
+            if frac < 1.0:
+                print('{} {}: {} agrees with {} on {:.2f}% of the costs'.format(
+                    a['graph'], a['reads'], algo, a['reference'], 100*frac))
+                failed = True
+
+    if args.baseline:
+        if not os.path.exists(args.baseline):
+            print('No baseline ' + args.baseline + ' (make bench-baseline stores one).')
+        else:
+            with open(args.baseline) as f:
+                regressions = compare(results, json.load(f), args.threshold)
+            for r in regressions:
+                print('Regression: ' + r)
+            if regressions:
+                failed = True
+            else:
+                print('No regressions beyond {:.0f}% against {}.'.format(100*args.threshold, args.baseline))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
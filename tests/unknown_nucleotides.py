@@ -0,0 +1,95 @@
+"""Checks that reads aligning next to an unknown nucleotide (N) get their optimal cost.
+
+Writes a random reference with runs of N of different lengths and exact reads (with each N replaced
+by some nucleotide) starting up to 20 letters before a run, spanning it, ending just before it and
+starting just after it, together with their reverse complements. Every read has an alignment of cost
+0, which each algorithm and trie layout has to find. Alignments do not start on an N (see
+graph_t::trie_exit), so the reads ending on an N are not reverse complemented.
+
+    python3 tests/unknown_nucleotides.py --astarix release/astarix --outdir tmp/unknown_nucleotides
+"""
+
+import argparse
+import csv
+import os
+import random
+import subprocess
+import sys
+
+REF_LEN = 20000
+N_RUNS = [(5000, 1), (10000, 10), (15000, 500)]  # (start, length)
+READ_LEN = 100
+MAX_OFFSET = 20                                  # reads start up to this many letters before a run
+
+RUNS = {
+    'seeds': ['-a', 'astar-seeds', '--fixed_trie_depth', '1', '--seeds_len', '25'],
+    'seeds-lazy': ['-a', 'astar-seeds', '--fixed_trie_depth', '1', '--seeds_len', '25', '--lazy_trie', '1'],
+    'seeds-variable': ['-a', 'astar-seeds', '--fixed_trie_depth', '0', '--seeds_len', '25'],
+    'prefix': ['-a', 'astar-prefix', '--fixed_trie_depth', '1'],
+    'dijkstra': ['-a', 'dijkstra', '--fixed_trie_depth', '1'],
+    'dijkstra-variable': ['-a', 'dijkstra', '--fixed_trie_depth', '0'],
+}
+
+
+def revcompl(s):
+    return s[::-1].translate(str.maketrans('ACGT', 'TGCA'))
+
+
+def write_inputs(outdir):
+    rnd = random.Random(42)
+    ref = [rnd.choice('ACGT') for _ in range(REF_LEN)]
+    for start, length in N_RUNS:
+        ref[start:start+length] = 'N' * length
+    ref = ''.join(ref)
+
+    reads = {}
+    def add_read(name, start):
+        reads[name] = ''.join(c if c != 'N' else rnd.choice('ACGT') for c in ref[start:start+READ_LEN])
+        if ref[start+READ_LEN-1] != 'N':
+            reads[name + '_rc'] = revcompl(reads[name])
+
+    for start, length in N_RUNS:
+        for offset in range(1, MAX_OFFSET+1):
+            add_read('before{}_{}'.format(start, offset), start - offset)
+        add_read('ending{}'.format(start), start - READ_LEN)
+        add_read('after{}'.format(start), start + length)
+
+    ref_file = os.path.join(outdir, 'ref.fa')
+    with open(ref_file, 'w') as f:
+        f.write('>unknown\n')
+        for i in range(0, len(ref), 80):
+            f.write(ref[i:i+80] + '\n')
+    reads_file = os.path.join(outdir, 'reads.fq')
+    with open(reads_file, 'w') as f:
+        for name, s in reads.items():
+            f.write('@{}\n{}\n+\n{}\n'.format(name, s, 'I' * len(s)))
+    return ref_file, reads_file, reads
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--astarix', default='release/astarix')
+    parser.add_argument('--outdir', default='tmp/unknown_nucleotides')
+    args = parser.parse_args()
+
+    os.makedirs(args.outdir, exist_ok=True)
+    ref_file, reads_file, reads = write_inputs(args.outdir)
+
+    failed = False
+    for name, flags in RUNS.items():
+        outdir = os.path.join(args.outdir, name)
+        cmd = [args.astarix, 'align-optimal', '-t', '1', '-v', '0', '-g', ref_file, '-q', reads_file, '-o', outdir] + flags
+        subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+        with open(os.path.join(outdir, 'alignments.tsv')) as f:
+            costs = {row['readname'].strip(): int(row['cost']) for row in csv.DictReader(f, delimiter='\t')}
+        wrong = sorted(read for read in reads if costs.get(read) != 0)
+        print('{:>20}: {} of {} reads with cost 0'.format(name, len(reads) - len(wrong), len(reads)))
+        for read in wrong:
+            print('{:>20}  {}: cost {}'.format('', read, costs.get(read, 'missing')))
+        failed |= bool(wrong)
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()